@@ -1,16 +1,20 @@
 import asyncio
 import aiohttp
 from bleak import BleakScanner
+import socket
 import sys
 import argparse
 
 parser = argparse.ArgumentParser(description='stream ble advertisements to homeassistant')
-parser.add_argument('--access-token', help='Long lived home assistant access token', required=True)
+parser.add_argument('--access-token', help='Long lived home assistant access token')
 parser.add_argument('--homeassistant', default='homeassistant.local', help='address of home assistant')
 parser.add_argument('--event', default='esphome.ble_tracking_beacon', help="Event to publish (you probably don't want to change this")
 parser.add_argument('--source', help='source to label the advertisements with (probably the room or device name)', required=True)
+parser.add_argument('--irkd', metavar='PORT', type=int, help='send advertisements to tools/irkd on this local UDP port, which resolves them and forwards only the matches, instead of posting every one to home assistant')
 parser.add_argument('-v', '--verbose', help='Output debugging info', action='store_true')
 args=parser.parse_args()
+if args.irkd is None and args.access_token is None:
+    parser.error('--access-token is required unless --irkd is given')
 
 if args.verbose:
     print(f'Launching with args {args}')
@@ -33,17 +37,21 @@ async def main():
 
     url = f"http://{args.homeassistant}:8123/api/events/{args.event}"
     counter = 0
+    irkd = socket.socket(socket.AF_INET, socket.SOCK_DGRAM) if args.irkd else None
     async with aiohttp.ClientSession() as session:
         async def callback(device, advertising_data):
+            nonlocal counter
+            counter += 1
+            if args.verbose:
+                print(f"recieving {steps[counter % len(steps)]}\r", end='')
+            if irkd is not None:
+                irkd.sendto(f"{device.address} {advertising_data.rssi}".encode(), ('127.0.0.1', args.irkd))
+                return
             data = {
                   "addr": device.address,
                   "source": args.source,
                   "rssi": device.rssi,
             }
-            nonlocal counter
-            counter += 1
-            if args.verbose:
-                print(f"recieving {steps[counter % len(steps)]}\r", end='')
             async with session.post(url, json = data, headers={'Authorization': f'Bearer {args.access_token}'}) as response:
                   data = await response.text()
 
@@ -1,35 +1,102 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import esp32_ble_server, text_sensor
-from esphome.const import CONF_ID
+from esphome import automation
+from esphome.components import esp32_ble, esp32_ble_server, sensor, text_sensor, time
+from esphome.const import CONF_ID, CONF_TIME_ID, STATE_CLASS_MEASUREMENT, UNIT_MILLISECOND
 
-AUTO_LOAD = ["esp32_ble", "esp32_ble_server", "text_sensor"]
+AUTO_LOAD = ["esp32_ble", "esp32_ble_server", "sensor", "text_sensor"]
 CODEOWNERS = ["@dgrnbrg"]
 CONFLICTS_WITH = ["esp32_ble_beacon"]
 DEPENDENCIES = ["esp32", "esp32_ble", "esp32_ble_server", "text_sensor"]
 
 CONF_LATEST_IRK = "latest_irk"
+CONF_MAX_IRKS = "max_irks"
+CONF_MAX_SESSIONS = "max_sessions"
+CONF_PAIRING_TIMEOUT = "pairing_timeout"
+CONF_ENROLLMENT_TIME = "enrollment_time"
+CONF_SLOT = "slot"
 
 irk_enrollment_ns = cg.esphome_ns.namespace("irk_enrollment")
 IrkEnrollmentComponent = irk_enrollment_ns.class_(
 "IrkEnrollmentComponent",
 cg.Component,
+esp32_ble.GAPEventHandler,
+esp32_ble.GATTsEventHandler,
 )
+ListAction = irk_enrollment_ns.class_("ListAction", automation.Action)
+RemoveAction = irk_enrollment_ns.class_("RemoveAction", automation.Action)
 
 CONFIG_SCHEMA = cv.Schema(
 {
 cv.GenerateID(): cv.declare_id(IrkEnrollmentComponent),
+cv.GenerateID(esp32_ble.CONF_BLE_ID): cv.use_id(esp32_ble.ESP32BLE),
 cv.Optional(CONF_LATEST_IRK): text_sensor.text_sensor_schema(
 icon="mdi:cellphone-key",
 ),
+cv.Optional(CONF_MAX_IRKS, default=8): cv.int_range(min=0, max=32),
+# Bluedroid allows CONFIG_BT_ACL_CONNECTIONS (4 by default) connections in all
+cv.Optional(CONF_MAX_SESSIONS, default=3): cv.int_range(min=1, max=9),
+cv.Optional(CONF_PAIRING_TIMEOUT, default="60s"): cv.positive_time_period_milliseconds,
+# From a phone connecting to its IRK being published
+cv.Optional(CONF_ENROLLMENT_TIME): sensor.sensor_schema(
+unit_of_measurement=UNIT_MILLISECOND,
+icon="mdi:timer-outline",
+accuracy_decimals=0,
+state_class=STATE_CLASS_MEASUREMENT,
+),
+cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
 }
 ).extend(cv.COMPONENT_SCHEMA)
 
+@automation.register_action("irk_enrollment.list", ListAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(IrkEnrollmentComponent),
+        }
+    )
+)
+async def irk_enrollment_list_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, paren)
+
+
+@automation.register_action("irk_enrollment.remove", RemoveAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(IrkEnrollmentComponent),
+            cv.Required(CONF_SLOT): cv.templatable(cv.int_range(min=0, max=31)),
+        }
+    )
+)
+async def irk_enrollment_remove_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    slot = await cg.templatable(config[CONF_SLOT], args, cg.int_)
+    cg.add(var.set_slot(slot))
+    return var
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
 
+    # Each connection is followed through GATTS connect and disconnect and the GAP pairing events
+    parent = await cg.get_variable(config[esp32_ble.CONF_BLE_ID])
+    cg.add(parent.register_gap_event_handler(var))
+    cg.add(parent.register_gatts_event_handler(var))
+    cg.add(var.set_max_sessions(config[CONF_MAX_SESSIONS]))
+    cg.add(var.set_pairing_timeout(config[CONF_PAIRING_TIMEOUT]))
+
 
     if CONF_LATEST_IRK in config:
         latest_irk = await text_sensor.new_text_sensor(config[CONF_LATEST_IRK])
         cg.add(var.set_latest_irk(latest_irk))
+
+    if CONF_ENROLLMENT_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_ENROLLMENT_TIME])
+        cg.add(var.set_enrollment_time_sensor(sens))
+
+    cg.add(var.set_max_irks(config[CONF_MAX_IRKS]))
+    if CONF_TIME_ID in config:
+        clock = await cg.get_variable(config[CONF_TIME_ID])
+        cg.add(var.set_time(clock))
@@ -0,0 +1,186 @@
+#include "enrollment_session.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace irk_enrollment {
+
+EnrollmentSessions::EnrollmentSessions(EnrollmentStack *stack, size_t max_sessions, uint32_t pairing_timeout_ms,
+                                       uint32_t gap_timeout_ms)
+    : stack_(stack),
+      sessions_(new EnrollmentSession[max_sessions]()),
+      count_(max_sessions),
+      pairing_timeout_ms_(pairing_timeout_ms),
+      gap_timeout_ms_(gap_timeout_ms) {}
+
+bool EnrollmentSessions::connected(const uint8_t *address, uint32_t now_ms) {
+  if (this->find_(address) != nullptr) {
+    return true;
+  }
+  for (size_t i = 0; i < this->count_; i++) {
+    auto &session = this->sessions_[i];
+    if (session.state == ENROLLMENT_IDLE) {
+      session = EnrollmentSession{};
+      memcpy(session.address, address, sizeof(session.address));
+      session.connected = true;
+      session.outcome = ENROLLMENT_LOST;
+      session.timings.connected_ms = now_ms;
+      this->enter_(session, ENROLLMENT_CONNECTED, now_ms);
+      return true;
+    }
+  }
+  return false;
+}
+
+void EnrollmentSessions::identity_key(const uint8_t *address, const uint8_t *irk, const uint8_t *identity) {
+  auto *session = this->find_(address);
+  if (session == nullptr) {
+    return;
+  }
+  memcpy(session->irk, irk, sizeof(session->irk));
+  memcpy(session->identity, identity, sizeof(session->identity));
+  session->has_irk = true;
+}
+
+void EnrollmentSessions::pairing_complete(const uint8_t *address, bool success, uint32_t now_ms) {
+  auto *session = this->find_(address);
+  if (session == nullptr || session->state != ENROLLMENT_CONNECTED) {
+    return;
+  }
+  if (success) {
+    // Without a key event, the identity key comes from the bond pairing just stored
+    if (!session->has_irk) {
+      session->has_irk = this->stack_->bonded_identity(session->address, session->irk, session->identity);
+    }
+    session->timings.paired_ms = now_ms;
+    this->enter_(*session, ENROLLMENT_PAIRED, now_ms);
+    return;
+  }
+  session->outcome = ENROLLMENT_PAIRING_FAILED;
+  this->enter_(*session, this->stack_->disconnect(session->address) ? ENROLLMENT_DISCONNECTING : ENROLLMENT_DISCONNECTED,
+               now_ms);
+}
+
+void EnrollmentSessions::disconnected(const uint8_t *address, uint32_t now_ms) {
+  auto *session = this->find_(address);
+  if (session == nullptr) {
+    return;
+  }
+  session->connected = false;
+  session->timings.disconnected_ms = now_ms;
+  if (session->state == ENROLLMENT_CONNECTED) {
+    this->finish_(*session, now_ms);
+  } else if (session->state == ENROLLMENT_DISCONNECTING) {
+    this->enter_(*session, ENROLLMENT_DISCONNECTED, now_ms);
+  }
+  // A paired session that hasn't been advanced yet sees connected == false and skips the disconnect
+}
+
+void EnrollmentSessions::bond_removed(const uint8_t *address, uint32_t now_ms) {
+  for (size_t i = 0; i < this->count_; i++) {
+    auto &session = this->sessions_[i];
+    if (session.state == ENROLLMENT_REMOVING_BOND && memcmp(session.bond_address(), address, 6) == 0) {
+      session.timings.removed_ms = now_ms;
+      this->finish_(session, now_ms);
+    }
+  }
+}
+
+bool EnrollmentSessions::advance(uint32_t now_ms) {
+  bool open = false;
+  for (size_t i = 0; i < this->count_; i++) {
+    this->advance_(this->sessions_[i], now_ms);
+    open |= this->sessions_[i].state != ENROLLMENT_IDLE;
+  }
+  return open;
+}
+
+void EnrollmentSessions::advance_(EnrollmentSession &session, uint32_t now_ms) {
+  // Ages are unsigned differences, so they survive a millis() wrap
+  uint32_t age = now_ms - session.since_ms;
+  switch (session.state) {
+    case ENROLLMENT_CONNECTED:
+      if (age >= this->pairing_timeout_ms_) {
+        session.outcome = ENROLLMENT_PAIRING_TIMEOUT;
+        this->enter_(session,
+                     this->stack_->disconnect(session.address) ? ENROLLMENT_DISCONNECTING : ENROLLMENT_DISCONNECTED,
+                     now_ms);
+      }
+      break;
+    case ENROLLMENT_PAIRED:
+      if (session.has_irk) {
+        session.outcome = ENROLLMENT_CAPTURED;
+        session.timings.captured_ms = now_ms;
+        if (this->on_captured_) {
+          this->on_captured_(session);
+        }
+      } else {
+        session.outcome = ENROLLMENT_NO_IRK;
+      }
+      if (session.connected && this->stack_->disconnect(session.address)) {
+        this->enter_(session, ENROLLMENT_DISCONNECTING, now_ms);
+      } else {
+        this->enter_(session, ENROLLMENT_DISCONNECTED, now_ms);
+      }
+      break;
+    case ENROLLMENT_DISCONNECTING:
+      if (age >= this->gap_timeout_ms_) {
+        session.gap_timeouts++;
+        this->enter_(session, ENROLLMENT_DISCONNECTED, now_ms);
+      }
+      break;
+    case ENROLLMENT_DISCONNECTED:
+      // Only a completed pairing leaves a bond behind
+      if (session.timings.paired_ms != 0 && this->stack_->remove_bond(session.bond_address())) {
+        this->enter_(session, ENROLLMENT_REMOVING_BOND, now_ms);
+      } else {
+        this->finish_(session, now_ms);
+      }
+      break;
+    case ENROLLMENT_REMOVING_BOND:
+      // The removal is confirmed by its event, or by the bond being gone when the event doesn't come
+      if (!this->stack_->has_bond(session.bond_address())) {
+        session.timings.removed_ms = now_ms;
+        this->finish_(session, now_ms);
+      } else if (age >= this->gap_timeout_ms_) {
+        session.gap_timeouts++;
+        this->finish_(session, now_ms);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+size_t EnrollmentSessions::active() const {
+  size_t active = 0;
+  for (size_t i = 0; i < this->count_; i++) {
+    active += this->sessions_[i].state != ENROLLMENT_IDLE;
+  }
+  return active;
+}
+
+EnrollmentSession *EnrollmentSessions::find_(const uint8_t *address) {
+  for (size_t i = 0; i < this->count_; i++) {
+    auto &session = this->sessions_[i];
+    if (session.state != ENROLLMENT_IDLE && memcmp(session.address, address, sizeof(session.address)) == 0) {
+      return &session;
+    }
+  }
+  return nullptr;
+}
+
+void EnrollmentSessions::enter_(EnrollmentSession &session, EnrollmentState state, uint32_t now_ms) {
+  session.state = state;
+  session.since_ms = now_ms;
+}
+
+void EnrollmentSessions::finish_(EnrollmentSession &session, uint32_t now_ms) {
+  if (this->on_finished_) {
+    this->on_finished_(session);
+  }
+  this->enter_(session, ENROLLMENT_IDLE, now_ms);
+}
+
+}  // namespace irk_enrollment
+}  // namespace esphome
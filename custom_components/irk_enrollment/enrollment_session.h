@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace esphome {
+namespace irk_enrollment {
+
+// Where an enrollment session is; each state waits for an event from the stack, or a timeout, to move on
+enum EnrollmentState : uint8_t {
+  ENROLLMENT_IDLE,
+  // Connected, waiting for pairing to complete
+  ENROLLMENT_CONNECTED,
+  // Paired; advance() captures the IRK and asks for a disconnect
+  ENROLLMENT_PAIRED,
+  ENROLLMENT_DISCONNECTING,
+  // Disconnected; advance() asks for the bond to be removed
+  ENROLLMENT_DISCONNECTED,
+  ENROLLMENT_REMOVING_BOND,
+};
+
+// How a session ended
+enum EnrollmentOutcome : uint8_t {
+  ENROLLMENT_CAPTURED,
+  // Paired without sharing an identity key, so there was no IRK
+  ENROLLMENT_NO_IRK,
+  ENROLLMENT_PAIRING_FAILED,
+  ENROLLMENT_PAIRING_TIMEOUT,
+  // The phone went away before pairing completed
+  ENROLLMENT_LOST,
+};
+
+// When a session reached each step, as millis(); 0 for a step it never reached
+struct EnrollmentTimings {
+  uint32_t connected_ms;
+  uint32_t paired_ms;
+  uint32_t captured_ms;
+  uint32_t disconnected_ms;
+  uint32_t removed_ms;
+};
+
+// One phone being enrolled, from its connection until its bond is gone
+struct EnrollmentSession {
+  EnrollmentState state;
+  EnrollmentOutcome outcome;
+  bool connected;
+  bool has_irk;
+  // Disconnects and bond removals that were never confirmed
+  uint8_t gap_timeouts;
+  // Connection address, which every event reports
+  uint8_t address[6];
+  // Identity address from the phone's identity key, which the bond is stored under
+  uint8_t identity[6];
+  // Most significant byte first
+  uint8_t irk[16];
+  // When the session entered its state
+  uint32_t since_ms;
+  EnrollmentTimings timings;
+
+  // Address the bond is stored under
+  const uint8_t *bond_address() const { return this->has_irk ? this->identity : this->address; }
+};
+
+/*
+ * The Bluetooth stack calls a session makes. disconnect() and remove_bond()
+ * only queue the work and return whether that succeeded; the other two read
+ * the stack's bond store. The store is read back because the host may not
+ * pass on every GAP event: the identity key and the bond removal are looked
+ * up there when their own events don't arrive.
+ */
+class EnrollmentStack {
+ public:
+  virtual ~EnrollmentStack() = default;
+  virtual bool disconnect(const uint8_t *address) = 0;
+  virtual bool remove_bond(const uint8_t *address) = 0;
+  // The identity key of the bond the phone connected as address just made, IRK most significant byte first;
+  // false when there is no such bond or it has no identity key
+  virtual bool bonded_identity(const uint8_t *address, uint8_t *irk, uint8_t *identity) = 0;
+  // Whether a bond is still stored under address
+  virtual bool has_bond(const uint8_t *address) = 0;
+};
+
+/*
+ * Enrolls up to a fixed number of phones at once, each in its own session:
+ * connected, paired, IRK captured, disconnected, bond removed. The event
+ * methods feed it what the stack reports, and advance() does the work that is
+ * due, one stack call per session at a time, and then waits for the event
+ * that confirms it. A step that is never confirmed times out, so a session
+ * can't get stuck. Pairing completing is the only GAP event it needs: a
+ * missing identity key event is made up for from the bond store, and a bond
+ * removal also counts as confirmed once the bond is gone from it. Nothing here knows about ESP-IDF, so the same code runs
+ * under tools/irk_enroll_harness.cpp against a scripted stack.
+ */
+class EnrollmentSessions {
+ public:
+  EnrollmentSessions(EnrollmentStack *stack, size_t max_sessions, uint32_t pairing_timeout_ms,
+                     uint32_t gap_timeout_ms);
+
+  // Opens a session for a new connection; false when every session is busy and the caller should drop it
+  bool connected(const uint8_t *address, uint32_t now_ms);
+  // The phone's identity key, IRK most significant byte first; optional, as pairing_complete() reads the bond
+  void identity_key(const uint8_t *address, const uint8_t *irk, const uint8_t *identity);
+  void pairing_complete(const uint8_t *address, bool success, uint32_t now_ms);
+  void disconnected(const uint8_t *address, uint32_t now_ms);
+  void bond_removed(const uint8_t *address, uint32_t now_ms);
+
+  // Does the work and timeouts that are due; returns whether any session is still open
+  bool advance(uint32_t now_ms);
+
+  // Called from advance() with the session whose IRK was just captured
+  void set_on_captured(std::function<void(const EnrollmentSession &)> &&callback) {
+    this->on_captured_ = std::move(callback);
+  }
+  // Called with every session that ends, just before it is freed
+  void set_on_finished(std::function<void(const EnrollmentSession &)> &&callback) {
+    this->on_finished_ = std::move(callback);
+  }
+
+  size_t size() const { return this->count_; }
+  size_t active() const;
+
+ protected:
+  EnrollmentSession *find_(const uint8_t *address);
+  void enter_(EnrollmentSession &session, EnrollmentState state, uint32_t now_ms);
+  void finish_(EnrollmentSession &session, uint32_t now_ms);
+  void advance_(EnrollmentSession &session, uint32_t now_ms);
+
+  EnrollmentStack *stack_;
+  std::unique_ptr<EnrollmentSession[]> sessions_;
+  size_t count_;
+  uint32_t pairing_timeout_ms_;
+  uint32_t gap_timeout_ms_;
+  std::function<void(const EnrollmentSession &)> on_captured_;
+  std::function<void(const EnrollmentSession &)> on_finished_;
+};
+
+}  // namespace irk_enrollment
+}  // namespace esphome
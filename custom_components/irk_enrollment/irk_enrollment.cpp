@@ -7,24 +7,91 @@
 
 #include <esp_gap_ble_api.h>
 #include <esp_bt_defs.h>
+#include <mbedtls/aes.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 namespace esphome {
 namespace irk_enrollment {
 
 static const char *const TAG = "irk_enrollment.component";
 
-constexpr char hexmap[] = {'0', '1', '2', '3', '4', '5', '6', '7',
-                           '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+// How long to wait for a disconnect or bond removal to be confirmed before moving on
+static const uint32_t GAP_TIMEOUT_MS = 5000;
 
-static std::string hexStr(unsigned char *data, int len) {
-  std::string s(len * 2, ' ');
-  for (int i = 0; i < len; ++i) {
-    s[2 * i] = hexmap[(data[len - 1 - i] & 0xF0) >> 4];
-    s[2 * i + 1] = hexmap[data[len - 1 - i] & 0x0F];
+// Whether the resolvable private address rpa resolves with irk, both most significant byte first
+static bool rpa_resolves(const uint8_t *rpa, const uint8_t *irk) {
+  if ((rpa[0] & 0xc0) != 0x40) {
+    return false;
   }
-  return s;
+  // The hash is e(irk, prand padded to 128 bits), truncated to 24 bits
+  uint8_t plain[16] = {0}, cipher[16];
+  memcpy(plain + 13, rpa, 3);
+  mbedtls_aes_context ctx;
+  mbedtls_aes_init(&ctx);
+  bool ok = mbedtls_aes_setkey_enc(&ctx, irk, 128) == 0 &&
+            mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, plain, cipher) == 0;
+  mbedtls_aes_free(&ctx);
+  return ok && memcmp(cipher + 13, rpa + 3, 3) == 0;
 }
 
+static std::vector<esp_ble_bond_dev_t> read_bonds() {
+  int num = esp_ble_get_bond_device_num();
+  std::vector<esp_ble_bond_dev_t> bonds(std::max(num, 0));
+  if (num > 0 && esp_ble_get_bond_device_list(&num, bonds.data()) == ESP_OK) {
+    bonds.resize(num);
+  } else {
+    bonds.clear();
+  }
+  return bonds;
+}
+
+/*
+ * disconnect() and remove_bond() only queue work for the Bluetooth task, which
+ * reports back through GATTS and GAP events. ESP32BLE only passes on some GAP
+ * events, which may leave out ESP_GAP_BLE_KEY_EVT and
+ * ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT, so the identity key and the bond's
+ * removal are also read back from the bond store.
+ */
+class EspEnrollmentStack : public EnrollmentStack {
+ public:
+  bool disconnect(const uint8_t *address) override {
+    return esp_ble_gap_disconnect(const_cast<uint8_t *>(address)) == ESP_OK;
+  }
+  bool remove_bond(const uint8_t *address) override {
+    return esp_ble_remove_bond_device(const_cast<uint8_t *>(address)) == ESP_OK;
+  }
+  bool bonded_identity(const uint8_t *address, uint8_t *irk, uint8_t *identity) override {
+    // The bond is stored under the identity address, while address is usually an RPA that resolves with its IRK
+    for (const auto &bond : read_bonds()) {
+      if (!(bond.bond_key.key_mask & ESP_LE_KEY_PID)) {
+        continue;
+      }
+      const auto &pid = bond.bond_key.pid_key;
+      uint8_t key[16];
+      for (int i = 0; i < 16; i++) {
+        key[i] = pid.irk[15 - i];
+      }
+      if (memcmp(bond.bd_addr, address, 6) == 0 || memcmp(pid.static_addr, address, 6) == 0 ||
+          rpa_resolves(address, key)) {
+        memcpy(irk, key, 16);
+        memcpy(identity, pid.static_addr, 6);
+        return true;
+      }
+    }
+    return false;
+  }
+  bool has_bond(const uint8_t *address) override {
+    auto bonds = read_bonds();
+    return std::any_of(bonds.begin(), bonds.end(),
+                       [&](const esp_ble_bond_dev_t &bond) { return memcmp(bond.bd_addr, address, 6) == 0; });
+  }
+};
+
+static EspEnrollmentStack ESP_ENROLLMENT_STACK;
+
 void IrkEnrollmentComponent::setup() {
   ESP_LOGCONFIG(TAG, "Setting up IRK Enrollment Component");
   
@@ -37,48 +104,249 @@ void IrkEnrollmentComponent::setup() {
   }
   
   this->ble_server_ = ble_server;
-  
+
+  this->slots_.resize(this->max_irks_);
+  for (size_t i = 0; i < this->max_irks_; i++) {
+    this->prefs_.push_back(global_preferences->make_preference<EnrolledIrk>(fnv1_hash("irk_enrollment") + i));
+    if (!this->prefs_[i].load(&this->slots_[i])) {
+      this->slots_[i] = EnrolledIrk{};
+    }
+  }
+  if (this->max_irks_ > 0) {
+    this->irks_callback_.call(this->irk_list_());
+  }
+
+  this->sessions_.reset(new EnrollmentSessions(&ESP_ENROLLMENT_STACK, this->max_sessions_, this->pairing_timeout_ms_,
+                                                GAP_TIMEOUT_MS));
+  this->sessions_->set_on_captured([this](const EnrollmentSession &session) {
+    this->capture_irk_(session.irk, session.identity);
+    if (this->enrollment_time_sensor_ != nullptr) {
+      this->enrollment_time_sensor_->publish_state(millis() - session.timings.connected_ms);
+    }
+  });
+  this->sessions_->set_on_finished([this](const EnrollmentSession &session) { this->log_finished_(session); });
+
+  // A bond left over from before a reboot is handled now; new connections wake loop() from the event handlers
+  this->process_bonded_devices();
+  this->disable_loop();
+
   ESP_LOGI(TAG, "IRK Enrollment Component setup complete");
 }
 
 void IrkEnrollmentComponent::dump_config() {
   ESP_LOGCONFIG(TAG, "ESP32 IRK Enrollment:");
   LOG_TEXT_SENSOR("  ", "Latest IRK", this->latest_irk_);
+  ESP_LOGCONFIG(TAG, "  Sessions: %u", (unsigned) this->max_sessions_);
+  ESP_LOGCONFIG(TAG, "  Pairing timeout: %ums", (unsigned) this->pairing_timeout_ms_);
+  LOG_SENSOR("  ", "Enrollment time", this->enrollment_time_sensor_);
+  if (this->max_irks_ > 0) {
+    size_t used = std::count_if(this->slots_.begin(), this->slots_.end(), [](const EnrolledIrk &e) { return e.used; });
+    ESP_LOGCONFIG(TAG, "  Stored IRKs: %u of %u", (unsigned) used, (unsigned) this->max_irks_);
+  }
+}
+
+void IrkEnrollmentComponent::gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+  // ESP32BLE dispatches GAP and GATTS events from its own loop(), so these handlers run on the main loop
+  if (this->sessions_ == nullptr) {
+    return;
+  }
+  switch (event) {
+    case ESP_GAP_BLE_KEY_EVT: {
+      // The identity key arrives during key distribution, before pairing completes; when this event isn't passed
+      // on, pairing_complete() reads the key from the bond instead
+      auto &key = param->ble_security.ble_key;
+      if (key.key_type == ESP_LE_KEY_PID) {
+        uint8_t irk[16];
+        for (int i = 0; i < 16; i++) {
+          irk[i] = key.p_key_value.pid_key.irk[15 - i];
+        }
+        this->sessions_->identity_key(key.bd_addr, irk, key.p_key_value.pid_key.static_addr);
+      }
+      return;
+    }
+    case ESP_GAP_BLE_AUTH_CMPL_EVT: {
+      auto &auth = param->ble_security.auth_cmpl;
+      if (!auth.success) {
+        ESP_LOGW(TAG, "Pairing failed, reason 0x%x", auth.fail_reason);
+      }
+      this->sessions_->pairing_complete(auth.bd_addr, auth.success, millis());
+      break;
+    }
+    case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:
+      // Only a shortcut: loop() also sees the bond gone from the bond store
+      this->sessions_->bond_removed(param->remove_bond_dev_cmpl.bd_addr, millis());
+      break;
+    default:
+      return;
+  }
+  this->enable_loop();
+}
+
+void IrkEnrollmentComponent::gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                                                 esp_ble_gatts_cb_param_t *param) {
+  if (this->sessions_ == nullptr) {
+    return;
+  }
+  if (event == ESP_GATTS_CONNECT_EVT) {
+    if (!this->sessions_->connected(param->connect.remote_bda, millis())) {
+      ESP_LOGW(TAG, "All %u enrollment sessions are busy, dropping the connection",
+               (unsigned) this->sessions_->size());
+      esp_ble_gap_disconnect(param->connect.remote_bda);
+      return;
+    }
+    // Connecting stops advertising; keep advertising so the next phone can connect while this one pairs
+    esp32_ble::global_ble->advertising_start();
+    this->enable_loop();
+  } else if (event == ESP_GATTS_DISCONNECT_EVT) {
+    this->sessions_->disconnected(param->disconnect.remote_bda, millis());
+    this->enable_loop();
+  }
 }
 
 void IrkEnrollmentComponent::loop() {
-  this->process_bonded_devices();
+  if (!this->sessions_->advance(millis())) {
+    this->disable_loop();
+  }
 }
 
-void IrkEnrollmentComponent::process_bonded_devices() {
-  int dev_num = esp_ble_get_bond_device_num();
-  if (dev_num > 1) {
-    ESP_LOGW(TAG, "We have %d bonds, where we expect to only ever have 0 or 1", dev_num);
+void IrkEnrollmentComponent::log_finished_(const EnrollmentSession &session) {
+  const auto &t = session.timings;
+  switch (session.outcome) {
+    case ENROLLMENT_CAPTURED:
+      ESP_LOGI(TAG, "Enrolled in %ums: paired after %ums, bond removed after %ums",
+               (unsigned) (t.captured_ms - t.connected_ms), (unsigned) (t.paired_ms - t.connected_ms),
+               (unsigned) (t.removed_ms != 0 ? t.removed_ms - t.connected_ms : 0));
+      break;
+    case ENROLLMENT_NO_IRK:
+      ESP_LOGW(TAG, "Paired without sharing an identity key, so there is no IRK to store");
+      break;
+    case ENROLLMENT_PAIRING_FAILED:
+      break;
+    case ENROLLMENT_PAIRING_TIMEOUT:
+      ESP_LOGW(TAG, "No pairing within %us, disconnected", (unsigned) (this->pairing_timeout_ms_ / 1000));
+      break;
+    case ENROLLMENT_LOST:
+      ESP_LOGW(TAG, "Disconnected before pairing");
+      break;
+  }
+  if (session.gap_timeouts > 0) {
+    ESP_LOGW(TAG, "%u disconnect or bond removal events never came", session.gap_timeouts);
+  }
+}
+
+void IrkEnrollmentComponent::capture_irk_(const uint8_t *irk, const uint8_t *identity) {
+  ESP_LOGI(TAG, "    remote BD_ADDR: %02x:%02x:%02x:%02x:%02x:%02x", identity[0], identity[1], identity[2],
+           identity[3], identity[4], identity[5]);
+  auto irkStr = format_hex(irk, 16);
+  ESP_LOGI(TAG, "      irk: %s", irkStr.c_str());
+
+  if (this->latest_irk_ != nullptr && this->latest_irk_->get_state() != irkStr) {
+    this->latest_irk_->publish_state(irkStr);
+  }
+
+  if (this->max_irks_ > 0) {
+    char label[sizeof(EnrolledIrk::label)];
+    snprintf(label, sizeof(label), "%02X:%02X:%02X:%02X:%02X:%02X", identity[0], identity[1], identity[2],
+             identity[3], identity[4], identity[5]);
+    this->store_irk_(irk, label);
   }
+}
 
-  if (dev_num == 0) {
-    return;  // No bonded devices
+void IrkEnrollmentComponent::process_bonded_devices() {
+  int dev_num = esp_ble_get_bond_device_num();
+  if (dev_num <= 0) {
+    return;  // No bonded devices, or Bluedroid isn't up yet
   }
 
   esp_ble_bond_dev_t bond_devs[dev_num];
   esp_ble_get_bond_device_list(&dev_num, bond_devs);
 
   for (int i = 0; i < dev_num; i++) {
-    ESP_LOGI(TAG, "    remote BD_ADDR: %02x:%02x:%02x:%02x:%02x:%02x",
-             bond_devs[i].bd_addr[0], bond_devs[i].bd_addr[1], bond_devs[i].bd_addr[2],
-             bond_devs[i].bd_addr[3], bond_devs[i].bd_addr[4], bond_devs[i].bd_addr[5]);
+    uint8_t irk[16];
+    for (int j = 0; j < 16; j++) {
+      irk[j] = bond_devs[i].bond_key.pid_key.irk[15 - j];
+    }
+    this->capture_irk_(irk, bond_devs[i].bd_addr);
+
+    // Nothing is connected yet at setup, so the bond can go straight away
+    esp_ble_remove_bond_device(bond_devs[i].bd_addr);
+    ESP_LOGI(TAG, "  Removed bond");
+  }
+}
+
+void IrkEnrollmentComponent::store_irk_(const uint8_t *irk, const char *label) {
+  int free_slot = -1;
+  for (size_t i = 0; i < this->slots_.size(); i++) {
+    if (!this->slots_[i].used) {
+      if (free_slot < 0) {
+        free_slot = i;
+      }
+    } else if (memcmp(this->slots_[i].irk, irk, 16) == 0) {
+      ESP_LOGI(TAG, "  IRK already stored in slot %u", (unsigned) i);
+      return;
+    }
+  }
+  if (free_slot < 0) {
+    ESP_LOGW(TAG, "  IRK store is full, remove one with irk_enrollment.remove");
+    return;
+  }
+
+  auto &slot = this->slots_[free_slot];
+  slot = EnrolledIrk{};
+  memcpy(slot.irk, irk, 16);
+  strncpy(slot.label, label, sizeof(slot.label) - 1);
+#ifdef USE_TIME
+  if (this->time_ != nullptr) {
+    auto now = this->time_->now();
+    if (now.is_valid()) {
+      slot.enrolled_at = now.timestamp;
+    }
+  }
+#endif
+  slot.used = true;
+  this->save_slot_(free_slot);
+  ESP_LOGI(TAG, "  Stored IRK in slot %d", free_slot);
+}
 
-    auto irkStr = hexStr((unsigned char *) &bond_devs[i].bond_key.pid_key.irk, 16);
-    ESP_LOGI(TAG, "      irk: %s", irkStr.c_str());
+void IrkEnrollmentComponent::remove_irk(int slot) {
+  if (slot < 0 || slot >= (int) this->slots_.size() || !this->slots_[slot].used) {
+    ESP_LOGW(TAG, "No IRK stored in slot %d", slot);
+    return;
+  }
+  this->slots_[slot] = EnrolledIrk{};
+  this->save_slot_(slot);
+  ESP_LOGI(TAG, "Removed the IRK in slot %d", slot);
+}
+
+void IrkEnrollmentComponent::save_slot_(size_t slot) {
+  this->prefs_[slot].save(&this->slots_[slot]);
+  // Enrollments are rare, so commit now instead of waiting for the next periodic sync
+  global_preferences->sync();
+  this->irks_callback_.call(this->irk_list_());
+}
 
-    if (this->latest_irk_ != nullptr && this->latest_irk_->get_state() != irkStr) {
-      this->latest_irk_->publish_state(irkStr);
+void IrkEnrollmentComponent::list_irks() {
+  ESP_LOGI(TAG, "Stored IRKs:");
+  for (size_t i = 0; i < this->slots_.size(); i++) {
+    const auto &slot = this->slots_[i];
+    if (slot.used) {
+      ESP_LOGI(TAG, "  Slot %u: %s, %s, enrolled at %u", (unsigned) i, format_hex(slot.irk, 16).c_str(), slot.label,
+               (unsigned) slot.enrolled_at);
     }
+  }
+}
 
-    esp_ble_gap_disconnect(bond_devs[i].bd_addr);
-    esp_ble_remove_bond_device(bond_devs[i].bd_addr);
-    ESP_LOGI(TAG, "  Disconnected and removed bond");
+std::string IrkEnrollmentComponent::irk_list_() const {
+  std::string list;
+  for (const auto &slot : this->slots_) {
+    if (slot.used) {
+      if (!list.empty()) {
+        list += ':';
+      }
+      list += format_hex(slot.irk, 16);
+    }
   }
+  return list;
 }
 
 float IrkEnrollmentComponent::get_setup_priority() const {
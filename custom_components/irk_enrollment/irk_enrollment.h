@@ -1,40 +1,130 @@
 #pragma once
 
 #include "esphome/core/defines.h"
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
 #include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/sensor/sensor.h"
 #include "esphome/components/text_sensor/text_sensor.h"
 #include "esphome/components/esp32_ble/ble.h"
 #include "esphome/components/esp32_ble_server/ble_server.h"
+#ifdef USE_TIME
+#include "esphome/components/time/real_time_clock.h"
+#endif
 
 #ifdef USE_ESP32
 
 #include <esp_gap_ble_api.h>
+#include <esp_gatts_api.h>
 #include <esp_bt_defs.h>
 
+#include "enrollment_session.h"
+
 namespace esphome {
 namespace irk_enrollment {
 
-class IrkEnrollmentComponent : public esphome::Component {
+// One slot of the enrollment store, saved to NVS as is
+struct EnrolledIrk {
+  // Most significant byte first, as latest_irk publishes it and irk_resolver takes it
+  uint8_t irk[16];
+  // Identity address the device bonded with
+  char label[24];
+  // Unix time, 0 when the clock wasn't set
+  uint32_t enrolled_at;
+  bool used;
+};
+
+class IrkEnrollmentComponent : public esphome::Component,
+                               public esp32_ble::GAPEventHandler,
+                               public esp32_ble::GATTsEventHandler {
 public:
   IrkEnrollmentComponent() {}
   void dump_config() override;
   void loop() override;
   void setup() override;
+  void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) override;
+  void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                           esp_ble_gatts_cb_param_t *param) override;
   void set_latest_irk(text_sensor::TextSensor *latest_irk) { latest_irk_ = latest_irk; }
+  // Publishes the time from a phone connecting to its IRK being published, in ms
+  void set_enrollment_time_sensor(sensor::Sensor *sensor) { enrollment_time_sensor_ = sensor; }
+  // Enrolls up to max_sessions phones at once; further connections are dropped until a session finishes
+  void set_max_sessions(size_t max_sessions) { max_sessions_ = max_sessions; }
+  // Drops a connection that hasn't paired within this time
+  void set_pairing_timeout(uint32_t pairing_timeout_ms) { pairing_timeout_ms_ = pairing_timeout_ms; }
+  // Keeps up to max_irks enrolled IRKs in NVS across reboots; 0 only publishes latest_irk
+  void set_max_irks(size_t max_irks) { max_irks_ = max_irks; }
+#ifdef USE_TIME
+  void set_time(time::RealTimeClock *time) { time_ = time; }
+#endif
+  // Called with the stored IRKs, colon-separated hex, once at setup and after every change
+  void add_on_irks_callback(std::function<void(const std::string &)> &&callback) {
+    irks_callback_.add(std::move(callback));
+  }
+
+  // Logs every stored IRK
+  void list_irks();
+  // Empties a slot of the store
+  void remove_irk(int slot);
+  const std::vector<EnrolledIrk> &enrolled() const { return slots_; }
   
   float get_setup_priority() const override;
 
 protected:
   text_sensor::TextSensor *latest_irk_{nullptr};
   
-  // Process bonded devices to extract IRKs
+  // Process bonds left over from before a reboot
   void process_bonded_devices();
+  // Publishes and stores an IRK captured from identity
+  void capture_irk_(const uint8_t *irk, const uint8_t *identity);
+
+  // Logs how a session ended
+  void log_finished_(const EnrollmentSession &session);
+
+  size_t max_sessions_{3};
+  uint32_t pairing_timeout_ms_{60000};
+  // Created in setup(); loop() only runs while a session is open
+  std::unique_ptr<EnrollmentSessions> sessions_;
+  sensor::Sensor *enrollment_time_sensor_{nullptr};
+
+  // Saves irk in the first free slot, unless it is already stored
+  void store_irk_(const uint8_t *irk, const char *label);
+  void save_slot_(size_t slot);
+  // The stored IRKs in irk_resolver's list format
+  std::string irk_list_() const;
+
+  size_t max_irks_{8};
+  std::vector<EnrolledIrk> slots_;
+  std::vector<ESPPreferenceObject> prefs_;
+  CallbackManager<void(const std::string &)> irks_callback_;
+#ifdef USE_TIME
+  time::RealTimeClock *time_{nullptr};
+#endif
   
   // Reference to the BLE server component
   esp32_ble_server::BLEServer *ble_server_{nullptr};
 };
 
+template<typename... Ts> class ListAction : public Action<Ts...> {
+ public:
+  ListAction(IrkEnrollmentComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->list_irks(); }
+
+  IrkEnrollmentComponent *parent_;
+};
+
+template<typename... Ts> class RemoveAction : public Action<Ts...> {
+ public:
+  RemoveAction(IrkEnrollmentComponent *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(int, slot)
+
+  void play(Ts... x) override { this->parent_->remove_irk(this->slot_.value(x...)); }
+
+  IrkEnrollmentComponent *parent_;
+};
+
 }  // namespace irk_enrollment
 }  // namespace esphome
 
@@ -0,0 +1,454 @@
+import base64
+
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.components import esp32_ble_tracker, sensor, text_sensor
+from esphome.const import (
+    CONF_ID,
+    CONF_TRIGGER_ID,
+    CONF_UPDATE_INTERVAL,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_PERCENT,
+)
+
+AUTO_LOAD = ["sensor", "text_sensor"]
+CODEOWNERS = ["@dgrnbrg"]
+DEPENDENCIES = ["esp32", "esp32_ble_tracker"]
+
+CONF_IRK_PREFILTER = "irk_prefilter"
+CONF_ENROLLMENT_ID = "enrollment_id"
+CONF_IRKS = "irks"
+CONF_ON_RESOLVED = "on_resolved"
+CONF_AGGREGATE = "aggregate"
+CONF_WINDOW = "window"
+CONF_ON_FIRST_SEEN = "on_first_seen"
+CONF_ON_WINDOW = "on_window"
+CONF_RSSI_FILTER = "rssi_filter"
+CONF_MODE = "mode"
+CONF_HALF_LIFE = "half_life"
+CONF_PROCESS_NOISE = "process_noise"
+CONF_MEASUREMENT_NOISE = "measurement_noise"
+CONF_OFFSET = "offset"
+CONF_RESOLVER_TASK = "resolver_task"
+CONF_CORE = "core"
+CONF_PRIORITY = "priority"
+CONF_QUEUE_SIZE = "queue_size"
+CONF_BATCH = "batch"
+CONF_MAX_RECORDS = "max_records"
+CONF_DEADLINE = "deadline"
+CONF_ON_FRAME = "on_frame"
+CONF_TRACE = "trace"
+CONF_CAPACITY = "capacity"
+CONF_SOURCE_ID = "source_id"
+CONF_SCAN_CONTROL = "scan_control"
+CONF_INTERVAL = "interval"
+CONF_MIN_DUTY = "min_duty"
+CONF_MAX_DUTY = "max_duty"
+CONF_STEP = "step"
+CONF_HOLD = "hold"
+CONF_NEARBY_TIMEOUT = "nearby_timeout"
+CONF_MAX_LOOP_LAG = "max_loop_lag"
+CONF_DUTY = "duty"
+CONF_METRICS = "metrics"
+CONF_ADVERTS = "adverts"
+CONF_NON_RPA = "non_rpa"
+CONF_CACHE_HITS = "cache_hits"
+CONF_CACHE_MISSES = "cache_misses"
+CONF_AES_BLOCKS = "aes_blocks"
+CONF_DROPPED = "dropped"
+CONF_RESOLVE_TIME_MEDIAN = "resolve_time_median"
+CONF_RESOLVE_TIME_P99 = "resolve_time_p99"
+
+UNIT_MICROSECOND = "µs"
+
+METRICS_COUNTERS = [
+    CONF_ADVERTS,
+    CONF_NON_RPA,
+    CONF_CACHE_HITS,
+    CONF_CACHE_MISSES,
+    CONF_AES_BLOCKS,
+    CONF_DROPPED,
+]
+METRICS_LATENCIES = [CONF_RESOLVE_TIME_MEDIAN, CONF_RESOLVE_TIME_P99]
+
+irk_resolver_ns = cg.esphome_ns.namespace("irk_resolver")
+# Only referenced by ID, so irk_enrollment stays optional
+IrkEnrollmentComponent = cg.esphome_ns.namespace("irk_enrollment").class_("IrkEnrollmentComponent", cg.Component)
+IrkResolverComponent = irk_resolver_ns.class_(
+    "IrkResolverComponent",
+    cg.Component,
+    esp32_ble_tracker.ESPBTDeviceListener,
+)
+ResolvedTrigger = irk_resolver_ns.class_(
+    "ResolvedTrigger", automation.Trigger.template(cg.int_, cg.int_, cg.uint64)
+)
+BeaconSummary = irk_resolver_ns.struct("BeaconSummary")
+BeaconSummaryConstRef = BeaconSummary.operator("ref").operator("const")
+FirstSeenTrigger = irk_resolver_ns.class_(
+    "FirstSeenTrigger", automation.Trigger.template(cg.int_, cg.int_, cg.uint64)
+)
+WindowTrigger = irk_resolver_ns.class_(
+    "WindowTrigger", automation.Trigger.template(BeaconSummaryConstRef)
+)
+RssiFilterMode = irk_resolver_ns.enum("RssiFilterMode")
+RSSI_FILTER_MODES = {
+    "EWMA": RssiFilterMode.RSSI_FILTER_EWMA,
+    "KALMAN": RssiFilterMode.RSSI_FILTER_KALMAN,
+}
+FrameConstRef = cg.std_vector.template(cg.uint8).operator("ref").operator("const")
+FrameTrigger = irk_resolver_ns.class_(
+    "FrameTrigger", automation.Trigger.template(FrameConstRef)
+)
+DumpTraceAction = irk_resolver_ns.class_("DumpTraceAction", automation.Action)
+
+BITSLICED_LANES = 32
+
+
+def validate_irk(value):
+    """An IRK as sensor.irk_prefilter lists it: 32 hex digits, or base64 with or without padding"""
+    value = cv.string_strict(value).strip()
+    try:
+        if len(value) == 32:
+            key = bytes.fromhex(value)
+        elif len(value) in (22, 24):
+            key = base64.b64decode(value.rstrip("=") + "==", validate=True)
+            if base64.b64encode(key).decode() != value.rstrip("=") + "==":
+                raise ValueError
+        else:
+            raise ValueError
+    except ValueError as err:
+        raise cv.Invalid(f"{value} is neither 32 hex digits nor a base64 IRK") from err
+    return key
+
+
+def validate_irks(value):
+    value = cv.ensure_list(validate_irk)(value)
+    if len(set(value)) != len(value):
+        raise cv.Invalid("IRKs must be unique")
+    return value
+
+
+def _aes_sbox():
+    def rotl8(x, shift):
+        return ((x << shift) | (x >> (8 - shift))) & 0xFF
+
+    # p walks the multiplicative group by 3, q by its inverse 1/3, so q = 1/p
+    sbox = [0x63] * 256
+    p = q = 1
+    while True:
+        p = p ^ ((p << 1) & 0xFF) ^ (0x1B if p & 0x80 else 0)
+        q ^= q << 1
+        q ^= q << 2
+        q ^= q << 4
+        q &= 0xFF
+        if q & 0x80:
+            q ^= 0x09
+        sbox[p] = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4) ^ 0x63
+        if p == 1:
+            return sbox
+
+
+def aes128_round_keys(key):
+    """The 11 round keys of AES-128, 16 bytes each (FIPS-197 section 5.2)"""
+    sbox = _aes_sbox()
+    words = [list(key[i : i + 4]) for i in range(0, 16, 4)]
+    rcon = 1
+    for i in range(4, 44):
+        temp = words[i - 1]
+        if i % 4 == 0:
+            temp = [sbox[b] for b in temp[1:] + temp[:1]]
+            temp[0] ^= rcon
+            rcon = ((rcon << 1) ^ (0x1B if rcon & 0x80 else 0)) & 0xFF
+        words.append([a ^ b for a, b in zip(words[i - 4], temp)])
+    return [sum(words[4 * r : 4 * r + 4], []) for r in range(11)]
+
+
+def bitsliced_batch_initializer(keys):
+    """A BitslicedIrkBatch initializer with keys expanded into its first lanes and the other lanes left zero"""
+    round_keys = [aes128_round_keys(key) for key in keys]
+    rounds = []
+    for r in range(11):
+        words = []
+        for i in range(16):
+            for b in range(8):
+                word = 0
+                for lane, rks in enumerate(round_keys):
+                    word |= ((rks[r][i] >> b) & 1) << lane
+                words.append(word)
+        rounds.append(
+            "{"
+            + ", ".join(
+                "{" + ", ".join(f"0x{w:08x}" for w in words[i * 8 : i * 8 + 8]) + "}"
+                for i in range(16)
+            )
+            + "}"
+        )
+    lanes = (1 << len(keys)) - 1
+    return "{{\n    " + ",\n    ".join(rounds) + f"}},\n   0x{lanes:08x}}}"
+
+
+def validate_scan_control(config):
+    if config[CONF_MIN_DUTY] > config[CONF_MAX_DUTY]:
+        raise cv.Invalid(f"{CONF_MIN_DUTY} can't be more than {CONF_MAX_DUTY}")
+    return config
+
+
+CONFIG_SCHEMA = (
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(IrkResolverComponent),
+            cv.Optional(CONF_IRK_PREFILTER): cv.use_id(text_sensor.TextSensor),
+            cv.Optional(CONF_IRKS): validate_irks,
+            cv.Optional(CONF_ENROLLMENT_ID): cv.use_id(IrkEnrollmentComponent),
+            cv.Optional(CONF_ON_RESOLVED): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ResolvedTrigger),
+                }
+            ),
+            cv.Optional(CONF_AGGREGATE): cv.Schema(
+                {
+                    cv.Optional(CONF_WINDOW, default="5s"): cv.positive_time_period_milliseconds,
+                    cv.Optional(CONF_ON_FIRST_SEEN): automation.validate_automation(
+                        {
+                            cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(FirstSeenTrigger),
+                        }
+                    ),
+                    cv.Optional(CONF_ON_WINDOW): automation.validate_automation(
+                        {
+                            cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(WindowTrigger),
+                        }
+                    ),
+                }
+            ),
+            cv.Optional(CONF_RESOLVER_TASK): cv.Schema(
+                {
+                    # Core 1 runs the main loop (and with it the API) at priority 1; on core 0, priority 1 sits
+                    # below Wi-Fi and Bluedroid (18 and up), so the task only takes time neither of them uses
+                    cv.Optional(CONF_CORE, default=0): cv.int_range(min=0, max=1),
+                    cv.Optional(CONF_PRIORITY, default=1): cv.int_range(min=1, max=24),
+                    cv.Optional(CONF_QUEUE_SIZE, default=256): cv.int_range(min=8, max=4096),
+                }
+            ),
+            cv.Optional(CONF_RSSI_FILTER): cv.Schema(
+                {
+                    cv.Optional(CONF_MODE, default="EWMA"): cv.enum(RSSI_FILTER_MODES, upper=True),
+                    # 0 would divide by zero on two samples in the same millisecond
+                    cv.Optional(CONF_HALF_LIFE, default="60s"): cv.All(
+                        cv.positive_time_period_milliseconds,
+                        cv.Range(min=cv.TimePeriod(milliseconds=1)),
+                    ),
+                    cv.Optional(CONF_PROCESS_NOISE, default=1.0): cv.positive_float,
+                    cv.Optional(CONF_MEASUREMENT_NOISE, default=36.0): cv.float_range(
+                        min=0, min_included=False
+                    ),
+                    cv.Optional(CONF_OFFSET, default=0.0): cv.float_,
+                }
+            ),
+            cv.Optional(CONF_BATCH): cv.Schema(
+                {
+                    cv.Optional(CONF_MAX_RECORDS, default=32): cv.int_range(min=1, max=255),
+                    cv.Optional(CONF_DEADLINE, default="1s"): cv.positive_time_period_milliseconds,
+                    cv.Optional(CONF_SOURCE_ID, default=0): cv.uint16_t,
+                    cv.Optional(CONF_ON_FRAME): automation.validate_automation(
+                        {
+                            cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(FrameTrigger),
+                        }
+                    ),
+                }
+            ),
+            cv.Optional(CONF_SCAN_CONTROL): cv.All(
+                cv.Schema(
+                    {
+                        cv.Optional(CONF_INTERVAL, default="320ms"): cv.All(
+                            cv.positive_time_period_milliseconds,
+                            cv.Range(
+                                min=cv.TimePeriod(milliseconds=10),
+                                max=cv.TimePeriod(milliseconds=10240),
+                            ),
+                        ),
+                        cv.Optional(CONF_UPDATE_INTERVAL, default="10s"): cv.positive_time_period_milliseconds,
+                        cv.Optional(CONF_MIN_DUTY, default="10%"): cv.percentage,
+                        cv.Optional(CONF_MAX_DUTY, default="90%"): cv.percentage,
+                        cv.Optional(CONF_STEP, default="10%"): cv.percentage,
+                        cv.Optional(CONF_HOLD, default="30s"): cv.positive_time_period_milliseconds,
+                        cv.Optional(CONF_NEARBY_TIMEOUT, default="60s"): cv.positive_time_period_milliseconds,
+                        cv.Optional(CONF_MAX_LOOP_LAG, default="100ms"): cv.positive_time_period_milliseconds,
+                        cv.Optional(CONF_DUTY): sensor.sensor_schema(
+                            unit_of_measurement=UNIT_PERCENT,
+                            accuracy_decimals=0,
+                            state_class=STATE_CLASS_MEASUREMENT,
+                            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+                        ),
+                    }
+                ),
+                validate_scan_control,
+            ),
+            cv.Optional(CONF_METRICS): cv.Schema(
+                {
+                    cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+                    **{
+                        cv.Optional(key): sensor.sensor_schema(
+                            accuracy_decimals=0,
+                            state_class=STATE_CLASS_TOTAL_INCREASING,
+                            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+                        )
+                        for key in METRICS_COUNTERS
+                    },
+                    **{
+                        cv.Optional(key): sensor.sensor_schema(
+                            unit_of_measurement=UNIT_MICROSECOND,
+                            accuracy_decimals=0,
+                            state_class=STATE_CLASS_MEASUREMENT,
+                            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+                        )
+                        for key in METRICS_LATENCIES
+                    },
+                }
+            ),
+            cv.Optional(CONF_TRACE): cv.Schema(
+                {
+                    cv.Optional(CONF_CAPACITY, default=2048): cv.int_range(min=1, max=65535),
+                    cv.Optional(CONF_SOURCE_ID, default=0): cv.uint16_t,
+                }
+            ),
+        }
+    )
+    .extend(esp32_ble_tracker.ESP_BLE_DEVICE_SCHEMA)
+    .extend(cv.COMPONENT_SCHEMA)
+)
+
+
+@automation.register_action("irk_resolver.dump_trace", DumpTraceAction,
+    cv.Schema(
+        {
+            cv.Required(CONF_ID): cv.use_id(IrkResolverComponent),
+        }
+    )
+)
+async def irk_resolver_dump_trace_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    return var
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    await esp32_ble_tracker.register_ble_device(var, config)
+
+    if CONF_IRKS in config:
+        # Static, so both arrays land in .rodata, i.e. flash. The bitsliced batches are only used, and only
+        # compiled, with IRK_RESOLVER_BITSLICED; otherwise the keys are expanded at boot for the per-IRK path
+        irks = config[CONF_IRKS]
+        keys = ",\n  ".join("{{" + ", ".join(f"0x{b:02x}" for b in key) + "}}" for key in irks)
+        batches = ",\n  ".join(
+            bitsliced_batch_initializer(irks[i : i + BITSLICED_LANES])
+            for i in range(0, len(irks), BITSLICED_LANES)
+        )
+        cg.add_global(
+            cg.RawStatement(
+                f"static const esphome::irk_resolver::Irk IRK_RESOLVER_STATIC_KEYS[] = {{\n  {keys}}};\n"
+                "#ifdef IRK_RESOLVER_BITSLICED\n"
+                f"static const esphome::irk_resolver::BitslicedIrkBatch IRK_RESOLVER_STATIC_BATCHES[] = {{\n  {batches}}};\n"
+                "#else\n"
+                "static const esphome::irk_resolver::BitslicedIrkBatch *const IRK_RESOLVER_STATIC_BATCHES = nullptr;\n"
+                "#endif"
+            )
+        )
+        cg.add(
+            var.set_static_irks(
+                cg.RawExpression(
+                    "esphome::irk_resolver::StaticIrkTable{IRK_RESOLVER_STATIC_KEYS, IRK_RESOLVER_STATIC_BATCHES, "
+                    f"{len(irks)}}}"
+                )
+            )
+        )
+
+    if CONF_IRK_PREFILTER in config:
+        irk_prefilter = await cg.get_variable(config[CONF_IRK_PREFILTER])
+        cg.add(var.set_irk_prefilter(irk_prefilter))
+
+    if CONF_ENROLLMENT_ID in config:
+        # The enrollment store reports its IRKs at setup and after every change
+        enrollment = await cg.get_variable(config[CONF_ENROLLMENT_ID])
+        cg.add(
+            enrollment.add_on_irks_callback(
+                cg.RawExpression(f"[](const std::string &irks) {{ {var}->set_local_irks(irks); }}")
+            )
+        )
+
+    if CONF_TRACE in config:
+        trace = config[CONF_TRACE]
+        cg.add(var.set_trace(trace[CONF_CAPACITY], trace[CONF_SOURCE_ID]))
+
+    for conf in config.get(CONF_ON_RESOLVED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(
+            trigger, [(cg.int_, "identity"), (cg.int_, "rssi"), (cg.uint64, "address")], conf
+        )
+
+    if CONF_AGGREGATE in config:
+        aggregate = config[CONF_AGGREGATE]
+        cg.add(var.set_aggregation_window(aggregate[CONF_WINDOW]))
+        for conf in aggregate.get(CONF_ON_FIRST_SEEN, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+            await automation.build_automation(
+                trigger, [(cg.int_, "identity"), (cg.int_, "rssi"), (cg.uint64, "address")], conf
+            )
+        for conf in aggregate.get(CONF_ON_WINDOW, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+            await automation.build_automation(trigger, [(BeaconSummaryConstRef, "summary")], conf)
+
+    if CONF_RESOLVER_TASK in config:
+        task = config[CONF_RESOLVER_TASK]
+        cg.add(var.set_resolver_task(task[CONF_CORE], task[CONF_PRIORITY], task[CONF_QUEUE_SIZE]))
+
+    if CONF_RSSI_FILTER in config:
+        rssi_filter = config[CONF_RSSI_FILTER]
+        cg.add(
+            var.set_rssi_filter(
+                rssi_filter[CONF_MODE],
+                rssi_filter[CONF_HALF_LIFE],
+                rssi_filter[CONF_PROCESS_NOISE],
+                rssi_filter[CONF_MEASUREMENT_NOISE],
+                rssi_filter[CONF_OFFSET],
+            )
+        )
+
+    if CONF_BATCH in config:
+        batch = config[CONF_BATCH]
+        cg.add(var.set_batch(batch[CONF_MAX_RECORDS], batch[CONF_DEADLINE], batch[CONF_SOURCE_ID]))
+        for conf in batch.get(CONF_ON_FRAME, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+            await automation.build_automation(trigger, [(FrameConstRef, "frame")], conf)
+
+    if CONF_SCAN_CONTROL in config:
+        scan_control = config[CONF_SCAN_CONTROL]
+        cg.add(
+            var.set_scan_control(
+                scan_control[CONF_INTERVAL],
+                scan_control[CONF_UPDATE_INTERVAL],
+                scan_control[CONF_MIN_DUTY],
+                scan_control[CONF_MAX_DUTY],
+                scan_control[CONF_STEP],
+                scan_control[CONF_HOLD],
+                scan_control[CONF_NEARBY_TIMEOUT],
+                scan_control[CONF_MAX_LOOP_LAG],
+            )
+        )
+        if CONF_DUTY in scan_control:
+            sens = await sensor.new_sensor(scan_control[CONF_DUTY])
+            cg.add(var.set_scan_duty_sensor(sens))
+
+    if CONF_METRICS in config:
+        metrics = config[CONF_METRICS]
+        # Compiles the counters into the resolver core as well, which doesn't see defines.h
+        cg.add_build_flag("-DIRK_RESOLVER_METRICS")
+        cg.add(var.set_metrics_interval(metrics[CONF_UPDATE_INTERVAL]))
+        for key in METRICS_COUNTERS + METRICS_LATENCIES:
+            if key in metrics:
+                sens = await sensor.new_sensor(metrics[key])
+                cg.add(getattr(var, f"set_{key}_sensor")(sens))
@@ -0,0 +1,228 @@
+// Only built for host tools; ESPHome builds use mbedtls, and the hardware AES on the ESP32
+#if !defined(USE_ARDUINO) && !defined(USE_ESP_IDF)
+
+#include "aes_host.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IRK_RESOLVER_AESNI
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define IRK_RESOLVER_ARMV8
+#endif
+
+namespace esphome {
+namespace irk_resolver {
+
+static const uint8_t SBOX[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9,
+    0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f,
+    0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15, 0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07,
+    0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3,
+    0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58,
+    0xcf, 0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3,
+    0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec, 0x5f,
+    0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73, 0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+    0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac,
+    0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a,
+    0xae, 0x08, 0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a, 0x70,
+    0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+    0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf, 0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42,
+    0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static inline uint8_t xtime(uint8_t b) { return (b << 1) ^ ((b & 0x80) ? 0x1b : 0); }
+
+void host_aes_expand(HostAesKey *key, const uint8_t *raw) {
+  uint8_t *w = &key->round_keys[0][0];
+  memcpy(w, raw, 16);
+  uint8_t rcon = 0x01;
+  for (int i = 16; i < 176; i += 4) {
+    uint8_t t[4] = {w[i - 4], w[i - 3], w[i - 2], w[i - 1]};
+    if (i % 16 == 0) {
+      // RotWord, SubWord and the round constant
+      uint8_t first = t[0];
+      t[0] = SBOX[t[1]] ^ rcon;
+      t[1] = SBOX[t[2]];
+      t[2] = SBOX[t[3]];
+      t[3] = SBOX[first];
+      rcon = xtime(rcon);
+    }
+    for (int j = 0; j < 4; j++) {
+      w[i + j] = w[i - 16 + j] ^ t[j];
+    }
+  }
+}
+
+static void encrypt_portable(const HostAesKey *key, const uint8_t *in, uint8_t *out) {
+  uint8_t s[16];
+  for (int i = 0; i < 16; i++) {
+    s[i] = in[i] ^ key->round_keys[0][i];
+  }
+  for (int r = 1; r <= 10; r++) {
+    // SubBytes and ShiftRows together: byte i comes from column (c + row) of the same row
+    uint8_t t[16];
+    for (int i = 0; i < 16; i++) {
+      t[i] = SBOX[s[(i + 4 * (i % 4)) % 16]];
+    }
+    if (r < 10) {
+      for (int c = 0; c < 16; c += 4) {
+        uint8_t a0 = t[c], a1 = t[c + 1], a2 = t[c + 2], a3 = t[c + 3], all = a0 ^ a1 ^ a2 ^ a3;
+        t[c] ^= all ^ xtime(a0 ^ a1);
+        t[c + 1] ^= all ^ xtime(a1 ^ a2);
+        t[c + 2] ^= all ^ xtime(a2 ^ a3);
+        t[c + 3] ^= all ^ xtime(a3 ^ a0);
+      }
+    }
+    for (int i = 0; i < 16; i++) {
+      s[i] = t[i] ^ key->round_keys[r][i];
+    }
+  }
+  memcpy(out, s, 16);
+}
+
+#ifdef IRK_RESOLVER_AESNI
+__attribute__((target("aes,sse2"))) static void encrypt_aesni(const HostAesKey *key, const uint8_t *in,
+                                                               uint8_t *out) {
+  const __m128i *rk = (const __m128i *) key->round_keys;
+  __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in), _mm_load_si128(rk));
+  for (int r = 1; r < 10; r++) {
+    b = _mm_aesenc_si128(b, _mm_load_si128(rk + r));
+  }
+  b = _mm_aesenclast_si128(b, _mm_load_si128(rk + 10));
+  _mm_storeu_si128((__m128i *) out, b);
+}
+#endif
+
+#ifdef IRK_RESOLVER_ARMV8
+__attribute__((target("+crypto"))) static void encrypt_armv8(const HostAesKey *key, const uint8_t *in,
+                                                              uint8_t *out) {
+  // AESE is AddRoundKey, SubBytes and ShiftRows; AESMC is MixColumns
+  uint8x16_t b = vld1q_u8(in);
+  for (int r = 0; r < 9; r++) {
+    b = vaesmcq_u8(vaeseq_u8(b, vld1q_u8(key->round_keys[r])));
+  }
+  b = veorq_u8(vaeseq_u8(b, vld1q_u8(key->round_keys[9])), vld1q_u8(key->round_keys[10]));
+  vst1q_u8(out, b);
+}
+#endif
+
+using EncryptFn = void (*)(const HostAesKey *, const uint8_t *, uint8_t *);
+
+static EncryptFn encrypt_fn(HostAesBackend backend) {
+  switch (backend) {
+#ifdef IRK_RESOLVER_AESNI
+    case HOST_AES_AESNI:
+      return encrypt_aesni;
+#endif
+#ifdef IRK_RESOLVER_ARMV8
+    case HOST_AES_ARMV8:
+      return encrypt_armv8;
+#endif
+    default:
+      return encrypt_portable;
+  }
+}
+
+bool host_aes_supported(HostAesBackend backend) {
+  switch (backend) {
+    case HOST_AES_PORTABLE:
+      return true;
+#ifdef IRK_RESOLVER_AESNI
+    case HOST_AES_AESNI:
+      return __builtin_cpu_supports("aes");
+#endif
+#ifdef IRK_RESOLVER_ARMV8
+    case HOST_AES_ARMV8:
+      return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#endif
+    default:
+      return false;
+  }
+}
+
+static void from_hex(const char *hex, uint8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned byte;
+    sscanf(hex + 2 * i, "%2x", &byte);
+    out[i] = byte;
+  }
+}
+
+bool host_aes_self_test(HostAesBackend backend) {
+  // FIPS-197 appendices B and C.1, then the Bluetooth Core Specification's ah() sample (Vol 3, Part H, D.7)
+  // with prand 0x708194 in the last three bytes; the hash 0x0dfbaa is the cipher text's last three bytes
+  static const char *const VECTORS[][3] = {
+      {"2b7e151628aed2a6abf7158809cf4f3c", "3243f6a8885a308d313198a2e0370734", "3925841d02dc09fbdc118597196a0b32"},
+      {"000102030405060708090a0b0c0d0e0f", "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a"},
+      {"ec0234a357c8ad05341010a60a397d9b", "00000000000000000000000000708194", "0dfbaa"},
+  };
+  EncryptFn encrypt = encrypt_fn(backend);
+  for (auto &vector : VECTORS) {
+    uint8_t raw[16], in[16], expected[16], out[16];
+    size_t n = strlen(vector[2]) / 2;
+    from_hex(vector[0], raw, 16);
+    from_hex(vector[1], in, 16);
+    from_hex(vector[2], expected, n);
+    HostAesKey key;
+    host_aes_expand(&key, raw);
+    encrypt(&key, in, out);
+    if (memcmp(out + 16 - n, expected, n) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char *host_aes_backend_name(HostAesBackend backend) {
+  switch (backend) {
+    case HOST_AES_AESNI:
+      return "aesni";
+    case HOST_AES_ARMV8:
+      return "armv8";
+    default:
+      return "portable";
+  }
+}
+
+static HostAesBackend select_backend() {
+  // Fastest first
+  static const HostAesBackend PREFERENCE[] = {HOST_AES_AESNI, HOST_AES_ARMV8, HOST_AES_PORTABLE};
+  const char *forced = getenv("IRK_RESOLVER_AES");
+  for (HostAesBackend backend : PREFERENCE) {
+    if (forced != nullptr && *forced != '\0' && strcmp(forced, host_aes_backend_name(backend)) != 0) {
+      continue;
+    }
+    if (!host_aes_supported(backend)) {
+      continue;
+    }
+    if (host_aes_self_test(backend)) {
+      return backend;
+    }
+    fprintf(stderr, "irk_resolver: %s AES failed its self-test\n", host_aes_backend_name(backend));
+  }
+  if (!host_aes_self_test(HOST_AES_PORTABLE)) {
+    fprintf(stderr, "irk_resolver: portable AES failed its self-test\n");
+    abort();
+  }
+  return HOST_AES_PORTABLE;
+}
+
+// Picked before main() runs, so encrypting never checks whether the choice has been made
+static const HostAesBackend BACKEND = select_backend();
+static const EncryptFn ENCRYPT = encrypt_fn(BACKEND);
+
+void host_aes_encrypt(const HostAesKey *key, const uint8_t *in, uint8_t *out) { ENCRYPT(key, in, out); }
+
+HostAesBackend host_aes_backend() { return BACKEND; }
+
+}  // namespace irk_resolver
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace irk_resolver {
+
+/*
+ * AES-128 encryption for host builds (Linux tools and daemons), used instead
+ * of mbedtls when neither USE_ARDUINO nor USE_ESP_IDF is defined. The key
+ * schedule is expanded once in software, in FIPS-197 byte order, which every
+ * backend reads as is. The block function is picked at startup: AES-NI on
+ * x86, the ARMv8 crypto extensions on 64-bit ARM, or a portable table-based
+ * fallback. A backend is only picked if it reproduces the FIPS-197 and
+ * Bluetooth ah() test vectors. IRK_RESOLVER_AES=portable, aesni or armv8 in the
+ * environment forces one, for testing.
+ */
+struct alignas(16) HostAesKey {
+  uint8_t round_keys[11][16];
+};
+
+enum HostAesBackend : uint8_t {
+  HOST_AES_PORTABLE,
+  HOST_AES_AESNI,
+  HOST_AES_ARMV8,
+};
+
+void host_aes_expand(HostAesKey *key, const uint8_t *raw);
+void host_aes_encrypt(const HostAesKey *key, const uint8_t *in, uint8_t *out);
+
+HostAesBackend host_aes_backend();
+const char *host_aes_backend_name(HostAesBackend backend);
+// Whether this CPU can run backend
+bool host_aes_supported(HostAesBackend backend);
+// Checks backend against the test vectors; it must be supported
+bool host_aes_self_test(HostAesBackend backend);
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,38 @@
+#include "aggregator.h"
+
+namespace esphome {
+namespace irk_resolver {
+
+bool BeaconAggregator::add(int identity, int rssi, uint64_t address, uint32_t now_ms) {
+  if ((size_t) identity >= this->windows_.size()) {
+    this->windows_.resize(identity + 1, Window{});
+  }
+  Window &w = this->windows_[identity];
+  // unsigned, so the gap survives a millis() wrap
+  bool first_seen = !w.seen || now_ms - w.last_seen_ms > this->window_ms_;
+  w.seen = true;
+  w.last_seen_ms = now_ms;
+  if (first_seen) {
+    return true;
+  }
+
+  if (w.count == 0) {
+    w.start_ms = now_ms;
+    w.rssi_sum = 0;
+    w.rssi_min = rssi;
+    w.rssi_max = rssi;
+  }
+  w.count++;
+  w.rssi_sum += rssi;
+  if (rssi < w.rssi_min) {
+    w.rssi_min = rssi;
+  }
+  if (rssi > w.rssi_max) {
+    w.rssi_max = rssi;
+  }
+  w.address = address;
+  return false;
+}
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace irk_resolver {
+
+// Resolved adverts from one identity over one window
+struct BeaconSummary {
+  int identity;
+  uint32_t count;
+  float rssi_mean;
+  int rssi_min;
+  int rssi_max;
+  // The address of the last advert in the window
+  uint64_t address;
+  uint32_t start_ms;
+  // RSSI from the component's rssi_filter at the end of the window, rssi_mean without one
+  float rssi_filtered;
+};
+
+/*
+ * Collapses resolved adverts into one summary per identity per window. The
+ * first advert from an identity that hasn't been seen for a whole window is
+ * reported straight away instead, so arrivals aren't delayed; the window
+ * opens with the advert after it. Every proxy is its own source, so keying
+ * by identity here is keying by (identity, source) across the house.
+ */
+class BeaconAggregator {
+ public:
+  explicit BeaconAggregator(uint32_t window_ms) : window_ms_(window_ms) {}
+
+  // Adds a resolved advert; returns true when it is a first sighting, which isn't added to any window
+  bool add(int identity, int rssi, uint64_t address, uint32_t now_ms);
+
+  // Calls emit(const BeaconSummary &) for every window that has closed by now_ms
+  template<typename F> void flush(uint32_t now_ms, F &&emit) {
+    for (size_t i = 0; i < this->windows_.size(); i++) {
+      Window &w = this->windows_[i];
+      if (w.count == 0 || now_ms - w.start_ms < this->window_ms_) {
+        continue;
+      }
+      BeaconSummary summary{(int) i, w.count, (float) w.rssi_sum / w.count, w.rssi_min, w.rssi_max, w.address,
+                            w.start_ms, NAN};
+      w.count = 0;
+      emit(summary);
+    }
+  }
+
+  uint32_t window_ms() const { return this->window_ms_; }
+
+ protected:
+  struct Window {
+    bool seen;
+    uint32_t last_seen_ms;
+    uint32_t start_ms;
+    uint32_t count;
+    int32_t rssi_sum;
+    int rssi_min;
+    int rssi_max;
+    uint64_t address;
+  };
+
+  uint32_t window_ms_;
+  // Indexed by identity
+  std::vector<Window> windows_;
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
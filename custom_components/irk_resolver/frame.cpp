@@ -0,0 +1,74 @@
+#include "frame.h"
+
+namespace esphome {
+namespace irk_resolver {
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  put_u16(p, v & 0xffff);
+  put_u16(p + 2, v >> 16);
+}
+
+uint32_t frame_identity_key(const uint8_t *irk) {
+  uint32_t hash = 2166136261UL;
+  for (int i = 0; i < 16; i++) {
+    hash ^= irk[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+FrameEncoder::FrameEncoder(size_t max_records, uint16_t source) : max_records_(max_records), source_(source) {
+  if (this->max_records_ > FRAME_MAX_RECORDS) {
+    this->max_records_ = FRAME_MAX_RECORDS;
+  }
+  this->buffer_.reserve(FRAME_HEADER_SIZE + this->max_records_ * FRAME_RECORD_SIZE);
+  this->clear();
+}
+
+bool FrameEncoder::add(uint32_t timestamp_ms, uint32_t identity_key, int8_t rssi) {
+  if (this->full()) {
+    return false;
+  }
+  uint32_t delta = 0;
+  if (this->count_ == 0) {
+    this->first_ms_ = timestamp_ms;
+  } else {
+    // unsigned, so the gap survives a millis() wrap
+    delta = timestamp_ms - this->last_ms_;
+    if (delta > 0xffff) {
+      return false;
+    }
+  }
+  this->last_ms_ = timestamp_ms;
+
+  uint8_t record[FRAME_RECORD_SIZE];
+  put_u16(record, delta);
+  put_u32(record + 2, identity_key);
+  record[6] = (uint8_t) rssi;
+  this->buffer_.insert(this->buffer_.end(), record, record + FRAME_RECORD_SIZE);
+  this->count_++;
+  return true;
+}
+
+const std::vector<uint8_t> &FrameEncoder::finish(uint32_t generation) {
+  uint8_t *header = this->buffer_.data();
+  header[0] = FRAME_VERSION;
+  header[1] = this->count_;
+  put_u16(header + 2, this->source_);
+  put_u32(header + 4, this->first_ms_);
+  put_u32(header + 8, generation);
+  return this->buffer_;
+}
+
+void FrameEncoder::clear() {
+  this->buffer_.assign(FRAME_HEADER_SIZE, 0);
+  this->count_ = 0;
+}
+
+}  // namespace irk_resolver
+}  // namespace esphome
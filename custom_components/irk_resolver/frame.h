@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace irk_resolver {
+
+/*
+ * Batched binary event frame: one header followed by fixed-width records, all
+ * little-endian and unaligned, decoded on the receiving side by irk_frames.py.
+ *
+ *   header  u8 version, u8 record count, u16 source, u32 first record's
+ *           timestamp in ms, u32 IRK set generation
+ *   record  u16 ms since the previous record (0 for the first), u32 identity
+ *           key, i8 rssi
+ *
+ * The identity key is frame_identity_key() of the identity's IRK rather than
+ * its index, which depends on the static, enrolled and prefilter IRKs the
+ * proxy holds and on the gaps removals left, so the receiver maps it back to a
+ * device from the IRKs alone.
+ */
+static const uint8_t FRAME_VERSION = 2;
+static const size_t FRAME_HEADER_SIZE = 12;
+static const size_t FRAME_RECORD_SIZE = 7;
+static const size_t FRAME_MAX_RECORDS = 255;
+
+// 32-bit FNV-1a of the IRK's 16 bytes, in the order sensor.irk_prefilter lists them
+uint32_t frame_identity_key(const uint8_t *irk);
+
+/*
+ * Builds one frame at a time into a buffer allocated up front. The caller
+ * sends the frame when it is full, when its oldest record is past a deadline,
+ * or when add() refuses a record because the gap to the previous one doesn't
+ * fit in 16 bits.
+ */
+class FrameEncoder {
+ public:
+  FrameEncoder(size_t max_records, uint16_t source);
+
+  // Appends a record; returns false when the frame has to be sent before it fits
+  bool add(uint32_t timestamp_ms, uint32_t identity_key, int8_t rssi);
+  // Fills in the header and returns the frame's bytes, valid until the next add() or clear()
+  const std::vector<uint8_t> &finish(uint32_t generation);
+  void clear();
+
+  size_t size() const { return this->count_; }
+  bool empty() const { return this->count_ == 0; }
+  bool full() const { return this->count_ == this->max_records_; }
+  uint32_t first_ms() const { return this->first_ms_; }
+
+ protected:
+  std::vector<uint8_t> buffer_;
+  size_t max_records_;
+  uint16_t source_;
+  size_t count_{0};
+  uint32_t first_ms_{0};
+  uint32_t last_ms_{0};
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,405 @@
+#include "irk_resolver.h"
+
+#include <cmath>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP32
+
+namespace esphome {
+namespace irk_resolver {
+
+static const char *const TAG = "irk_resolver";
+
+// BLE scan intervals and windows are in units of 0.625 ms, and a window is at least 4 of them
+static const float SCAN_UNIT_MS = 0.625f;
+static const uint32_t MIN_SCAN_WINDOW = 4;
+
+// Records per log line when dumping a trace, and log lines per loop()
+static const size_t TRACE_RECORDS_PER_LINE = 4;
+static const size_t TRACE_LINES_PER_LOOP = 4;
+
+std::string format_address(uint64_t address) {
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", (uint8_t) (address >> 40), (uint8_t) (address >> 32),
+           (uint8_t) (address >> 24), (uint8_t) (address >> 16), (uint8_t) (address >> 8), (uint8_t) address);
+  return buf;
+}
+
+void IrkResolverComponent::setup() {
+  if (this->trace_capacity_ > 0) {
+    this->trace_.reset(new TraceRecorder(this->trace_capacity_));
+  }
+  if (this->aggregation_window_ms_ > 0) {
+    this->aggregator_.reset(new BeaconAggregator(this->aggregation_window_ms_));
+  }
+  if (this->batch_max_records_ > 0) {
+    this->batch_.reset(new FrameEncoder(this->batch_max_records_, this->batch_source_));
+  }
+  if (this->task_ring_size_ > 0) {
+    this->task_.reset(new ResolverTask(this->resolver_, this->task_ring_size_));
+    if (!this->task_->start(this->task_core_, this->task_priority_)) {
+      ESP_LOGE(TAG, "Could not start the resolver task, resolving inline");
+      this->task_.reset();
+    }
+  }
+  if (this->scan_controller_ != nullptr) {
+    // A new window only takes effect when the tracker restarts its scan, so restart at least once per update
+    this->parent_->set_scan_duration(std::max<uint32_t>(1, (this->scan_update_interval_ms_ + 999) / 1000));
+    this->update_scan_duty_();
+    this->set_interval("scan_control", this->scan_update_interval_ms_, [this]() { this->update_scan_duty_(); });
+  }
+#ifdef IRK_RESOLVER_METRICS
+  this->set_interval("metrics", this->metrics_interval_ms_, [this]() { this->publish_metrics_(); });
+#endif
+  if (this->irk_prefilter_ != nullptr) {
+    this->irk_prefilter_->add_on_state_callback([this](const std::string &state) { this->load_irks(state); });
+    if (this->irk_prefilter_->has_state()) {
+      this->load_irks(this->irk_prefilter_->get_state());
+    }
+  }
+}
+
+void IrkResolverComponent::loop() {
+  if (this->scan_controller_ != nullptr) {
+    uint32_t now = millis();
+    if (this->last_loop_ms_ != 0) {
+      this->loop_lag_ms_ = std::max(this->loop_lag_ms_, now - this->last_loop_ms_);
+    }
+    this->last_loop_ms_ = now;
+  }
+  this->handle_task_results_();
+  if (this->aggregator_ != nullptr) {
+    this->aggregator_->flush(millis(), [this](const BeaconSummary &summary) {
+      BeaconSummary filtered = summary;
+      // Without a filter the mean stands in, so the event never carries NaN
+      float rssi = this->get_filtered_rssi(summary.identity);
+      filtered.rssi_filtered = std::isnan(rssi) ? summary.rssi_mean : rssi;
+      this->window_callback_.call(filtered);
+    });
+  }
+  if (this->batch_ != nullptr && !this->batch_->empty() &&
+      millis() - this->batch_->first_ms() >= this->batch_deadline_ms_) {
+    this->send_frame_();
+  }
+  if (this->trace_dump_pos_ < 0) {
+    return;
+  }
+
+  // The header goes out on the "trace begin" line, records follow in order
+  if (this->trace_dump_pos_ == 0) {
+    TraceHeader header = this->trace_->header();
+    ESP_LOGI(TAG, "trace begin %s", format_hex((const uint8_t *) &header, sizeof(header)).c_str());
+  }
+  for (size_t line = 0; line < TRACE_LINES_PER_LOOP; line++) {
+    size_t pos = this->trace_dump_pos_;
+    size_t n = std::min(TRACE_RECORDS_PER_LINE, this->trace_->size() - pos);
+    if (n == 0) {
+      ESP_LOGI(TAG, "trace end, %u records, %u dropped", (unsigned) this->trace_->size(),
+               (unsigned) this->trace_->dropped());
+      this->trace_->clear();
+      this->trace_dump_pos_ = -1;
+      return;
+    }
+    TraceRecord records[TRACE_RECORDS_PER_LINE];
+    for (size_t i = 0; i < n; i++) {
+      records[i] = this->trace_->at(pos + i);
+    }
+    ESP_LOGI(TAG, "trace %s", format_hex((const uint8_t *) records, n * sizeof(TraceRecord)).c_str());
+    this->trace_dump_pos_ += n;
+  }
+}
+
+void IrkResolverComponent::dump_trace() {
+  if (this->trace_ == nullptr) {
+    ESP_LOGW(TAG, "Tracing is not configured");
+    return;
+  }
+  if (this->trace_dump_pos_ < 0) {
+    this->trace_dump_pos_ = 0;
+  }
+}
+
+void IrkResolverComponent::dump_config() {
+  ESP_LOGCONFIG(TAG, "IRK Resolver:");
+  ESP_LOGCONFIG(TAG, "  IRKs loaded: %u", (unsigned) this->resolver_.size());
+  if (this->resolver_.static_count() > 0) {
+    ESP_LOGCONFIG(TAG, "  Static IRKs: %u", (unsigned) this->resolver_.static_count());
+  }
+  ESP_LOGCONFIG(TAG, "  Generation: %u", (unsigned) this->resolver_.generation());
+#ifdef IRK_RESOLVER_BITSLICED
+  ESP_LOGCONFIG(TAG, "  AES: bitsliced");
+#else
+  ESP_LOGCONFIG(TAG, "  AES: mbedtls");
+#endif
+  LOG_TEXT_SENSOR("  ", "IRK prefilter", this->irk_prefilter_);
+  if (this->aggregation_window_ms_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Aggregation window: %u ms", (unsigned) this->aggregation_window_ms_);
+  }
+  if (this->rssi_filter_ != nullptr) {
+    ESP_LOGCONFIG(TAG, "  RSSI filter: %s, half-life %u ms, offset %.1f dB",
+                  this->rssi_filter_->mode() == RSSI_FILTER_EWMA ? "EWMA" : "Kalman",
+                  (unsigned) this->rssi_filter_->half_life_ms(), this->rssi_filter_->offset());
+  }
+  if (this->batch_max_records_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Batch: %u records, %u ms deadline, source %u", (unsigned) this->batch_max_records_,
+                  (unsigned) this->batch_deadline_ms_, this->batch_source_);
+  }
+  if (this->task_ring_size_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Resolver task: core %d, priority %d, %u adverts queued at most", this->task_core_,
+                  this->task_priority_, (unsigned) this->task_ring_size_);
+  }
+  if (this->scan_controller_ != nullptr) {
+    ESP_LOGCONFIG(TAG, "  Scan control: %u ms interval, %.0f%% to %.0f%% duty, updated every %u ms",
+                  (unsigned) this->scan_interval_ms_, this->scan_controller_->min_duty() * 100,
+                  this->scan_controller_->max_duty() * 100, (unsigned) this->scan_update_interval_ms_);
+    LOG_SENSOR("    ", "Scan duty", this->scan_duty_sensor_);
+  }
+  if (this->trace_capacity_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Trace: %u records, source %u", (unsigned) this->trace_capacity_, this->trace_source_);
+  }
+#ifdef IRK_RESOLVER_METRICS
+  ESP_LOGCONFIG(TAG, "  Metrics: every %u ms", (unsigned) this->metrics_interval_ms_);
+  LOG_SENSOR("  ", "Adverts", this->adverts_sensor_);
+  LOG_SENSOR("  ", "Non-RPA adverts", this->non_rpa_sensor_);
+  LOG_SENSOR("  ", "Cache hits", this->cache_hits_sensor_);
+  LOG_SENSOR("  ", "Cache misses", this->cache_misses_sensor_);
+  LOG_SENSOR("  ", "AES blocks", this->aes_blocks_sensor_);
+  LOG_SENSOR("  ", "Dropped adverts", this->dropped_sensor_);
+  LOG_SENSOR("  ", "Resolve time median", this->resolve_time_median_sensor_);
+  LOG_SENSOR("  ", "Resolve time p99", this->resolve_time_p99_sensor_);
+#endif
+}
+
+float IrkResolverComponent::get_setup_priority() const { return setup_priority::AFTER_BLUETOOTH; }
+
+void IrkResolverComponent::load_irks(const std::string &irks) {
+  IrkListParseResult result;
+  bool expanded = false;
+  this->update_resolver_([&](IrkResolver &resolver) {
+    auto &table = resolver.begin_update();
+    result = parse_irk_list(irks, table);
+    merge_irk_list("", this->local_irks_, table);
+    expanded = resolver.publish();
+    resolver.set_generation(result.generation);
+  });
+  if (!expanded) {
+    ESP_LOGW(TAG, "Could not expand every IRK");
+  }
+  if (result.rejected > 0) {
+    ESP_LOGW(TAG, "Rejected %u malformed IRKs", (unsigned) result.rejected);
+  }
+  ESP_LOGD(TAG, "Loaded %u IRKs, generation %u", (unsigned) result.loaded, (unsigned) result.generation);
+}
+
+void IrkResolverComponent::apply_delta(const std::string &delta) {
+  IrkDeltaResult result;
+  this->update_resolver_([&](IrkResolver &resolver) { result = apply_irk_delta(delta, resolver); });
+  if (result.stale) {
+    ESP_LOGW(TAG, "Ignoring IRK delta that does not follow generation %u", (unsigned) this->resolver_.generation());
+    return;
+  }
+  if (result.rejected > 0) {
+    ESP_LOGW(TAG, "Rejected %u malformed IRK delta entries", (unsigned) result.rejected);
+  }
+  ESP_LOGD(TAG, "Added %u and removed %u IRKs, %u loaded, generation %u", (unsigned) result.added,
+           (unsigned) result.removed, (unsigned) this->resolver_.size(), (unsigned) this->resolver_.generation());
+}
+
+void IrkResolverComponent::set_local_irks(const std::string &irks) {
+  IrkDeltaResult result;
+  bool expanded = false;
+  this->update_resolver_([&](IrkResolver &resolver) {
+    result = merge_irk_list(this->local_irks_, irks, resolver.begin_delta());
+    expanded = resolver.publish();
+  });
+  this->local_irks_ = irks;
+  if (!expanded) {
+    ESP_LOGW(TAG, "Could not expand every IRK");
+  }
+  if (result.rejected > 0) {
+    ESP_LOGW(TAG, "Rejected %u malformed local IRKs", (unsigned) result.rejected);
+  }
+  ESP_LOGD(TAG, "Added %u and removed %u local IRKs, %u loaded", (unsigned) result.added, (unsigned) result.removed,
+           (unsigned) this->resolver_.size());
+}
+
+bool IrkResolverComponent::parse_device(const esp32_ble_tracker::ESPBTDevice &device) {
+#ifdef IRK_RESOLVER_METRICS
+  this->adverts_seen_++;
+#endif
+  // Recording pauses while a dump is in progress so the dump is a consistent snapshot
+  if (this->trace_ != nullptr && this->trace_dump_pos_ < 0) {
+    this->trace_->record(millis(), device.address_uint64(), device.get_address_type(), device.get_rssi(),
+                         this->trace_source_);
+  }
+
+  // Only random resolvable private addresses can be resolved; skip everything else before any lookup
+  uint64_t address = device.address_uint64();
+  if (device.get_address_type() != BLE_ADDR_TYPE_RANDOM || !is_rpa(address)) {
+#ifdef IRK_RESOLVER_METRICS
+    this->non_rpa_++;
+#endif
+    return false;
+  }
+
+  // With a resolver task, matches come back through loop()
+  if (this->task_ != nullptr) {
+    this->task_->submit(address, device.get_rssi(), millis());
+    return false;
+  }
+
+  uint8_t rpa[6];
+  rpa_from_uint64(address, rpa);
+  uint32_t now = millis();
+  int identity = this->resolver_.resolve(rpa, now);
+  if (identity < 0) {
+    return false;
+  }
+  this->handle_resolved_(identity, device.get_rssi(), address, now);
+  return true;
+}
+
+ResolverStats IrkResolverComponent::get_resolver_stats() {
+  ResolverStats stats{};
+  this->with_resolver_([&](IrkResolver &resolver) {
+    stats.cache_hits = resolver.cache_hits();
+    stats.cache_misses = resolver.cache_misses();
+    stats.mean_rotation_interval_ms = resolver.identities().mean_rotation_interval_ms();
+  });
+  return stats;
+}
+
+void IrkResolverComponent::handle_task_results_() {
+  if (this->task_ == nullptr) {
+    return;
+  }
+  ResolvedRecord record;
+  while (this->task_->poll(&record)) {
+    this->handle_resolved_(record.identity, record.rssi, record.address, record.timestamp_ms);
+  }
+}
+
+void IrkResolverComponent::handle_resolved_(int identity, int rssi, uint64_t address, uint32_t timestamp_ms) {
+  ESP_LOGV(TAG, "Resolved idx %d", identity);
+  if (this->rssi_filter_ != nullptr) {
+    this->rssi_filter_->update(identity, rssi, timestamp_ms);
+  }
+  if (this->scan_controller_ != nullptr) {
+    this->scan_controller_->resolved(timestamp_ms);
+  }
+  this->resolved_callback_.call(identity, rssi, address);
+  if (this->aggregator_ != nullptr && this->aggregator_->add(identity, rssi, address, timestamp_ms)) {
+    if (this->scan_controller_ != nullptr) {
+      this->scan_controller_->first_seen(timestamp_ms);
+    }
+    this->first_seen_callback_.call(identity, rssi, address);
+  }
+  // Frames carry the IRK's key rather than the identity index, which the receiver can't reproduce
+  const uint8_t *irk = this->batch_ != nullptr ? this->resolver_.irk(identity) : nullptr;
+  if (irk != nullptr) {
+    uint32_t key = frame_identity_key(irk);
+    if (!this->batch_->add(timestamp_ms, key, rssi)) {
+      this->send_frame_();
+      this->batch_->add(timestamp_ms, key, rssi);
+    }
+    if (this->batch_->full()) {
+      this->send_frame_();
+    }
+  }
+}
+
+void IrkResolverComponent::send_frame_() {
+  this->frame_callback_.call(this->batch_->finish(this->resolver_.generation()));
+  this->batch_->clear();
+}
+
+void IrkResolverComponent::update_scan_duty_() {
+  static const char *const REASONS[] = {"arrival", "nearby", "quiet", "congested"};
+  float duty = this->scan_controller_->update(millis(), this->loop_lag_ms_);
+  this->loop_lag_ms_ = 0;
+
+  uint32_t interval = lroundf(this->scan_interval_ms_ / SCAN_UNIT_MS);
+  uint32_t window = std::min(interval, std::max(MIN_SCAN_WINDOW, (uint32_t) lroundf(duty * interval)));
+  if (window == this->scan_window_) {
+    return;
+  }
+  this->scan_window_ = window;
+  this->parent_->set_scan_interval(interval);
+  this->parent_->set_scan_window(window);
+  ESP_LOGD(TAG, "Scan window %.1f ms of %u ms (%s)", window * SCAN_UNIT_MS, (unsigned) this->scan_interval_ms_,
+           REASONS[this->scan_controller_->reason()]);
+  if (this->scan_duty_sensor_ != nullptr) {
+    this->scan_duty_sensor_->publish_state(100.0f * window / interval);
+  }
+}
+
+#ifdef IRK_RESOLVER_METRICS
+void IrkResolverComponent::publish_metrics_() {
+  // Copied under the resolver task's lock, so the task keeps resolving while these are published
+  uint32_t cache_hits = 0, cache_misses = 0, aes_blocks = 0;
+  LatencyHistogram resolve_us;
+  std::vector<uint32_t> matches;
+  this->with_resolver_([&](IrkResolver &resolver) {
+    cache_hits = resolver.cache_hits();
+    cache_misses = resolver.cache_misses();
+    aes_blocks = resolver.metrics().aes_blocks;
+    resolve_us = resolver.metrics().resolve_us;
+    resolver.metrics().resolve_us.clear();
+    matches = resolver.metrics().matches;
+  });
+  uint32_t dropped = 0;
+  if (this->task_ != nullptr) {
+    dropped = this->task_->dropped_adverts() + this->task_->dropped_results();
+  }
+
+  if (this->adverts_sensor_ != nullptr) {
+    this->adverts_sensor_->publish_state(this->adverts_seen_);
+  }
+  if (this->non_rpa_sensor_ != nullptr) {
+    this->non_rpa_sensor_->publish_state(this->non_rpa_);
+  }
+  if (this->cache_hits_sensor_ != nullptr) {
+    this->cache_hits_sensor_->publish_state(cache_hits);
+  }
+  if (this->cache_misses_sensor_ != nullptr) {
+    this->cache_misses_sensor_->publish_state(cache_misses);
+  }
+  if (this->aes_blocks_sensor_ != nullptr) {
+    this->aes_blocks_sensor_->publish_state(aes_blocks);
+  }
+  if (this->dropped_sensor_ != nullptr) {
+    this->dropped_sensor_->publish_state(dropped);
+  }
+  // No resolves this interval publishes NAN rather than a latency of 0
+  if (this->resolve_time_median_sensor_ != nullptr) {
+    this->resolve_time_median_sensor_->publish_state(resolve_us.count() > 0 ? resolve_us.quantile_us(0.5f) : NAN);
+  }
+  if (this->resolve_time_p99_sensor_ != nullptr) {
+    this->resolve_time_p99_sensor_->publish_state(resolve_us.count() > 0 ? resolve_us.quantile_us(0.99f) : NAN);
+  }
+
+  // The full histogram and the per-identity counts don't fit a sensor, so they go to the log
+  std::string buckets;
+  for (size_t b = 0; b < LatencyHistogram::BUCKETS; b++) {
+    if (resolve_us.bucket(b) > 0) {
+      buckets += str_sprintf(" <%uus:%u", (unsigned) LatencyHistogram::bucket_limit_us(b),
+                             (unsigned) resolve_us.bucket(b));
+    }
+  }
+  ESP_LOGD(TAG, "Resolve times over %u resolves:%s", (unsigned) resolve_us.count(), buckets.c_str());
+  std::string counts;
+  for (size_t i = 0; i < matches.size(); i++) {
+    if (matches[i] > 0) {
+      counts += str_sprintf(" %u:%u", (unsigned) i, (unsigned) matches[i]);
+    }
+  }
+  ESP_LOGD(TAG, "Matches per identity:%s", counts.c_str());
+}
+#endif
+
+}  // namespace irk_resolver
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include "esphome/core/automation.h"
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/text_sensor/text_sensor.h"
+
+#ifdef USE_ESP32
+
+#include "esphome/components/esp32_ble_tracker/esp32_ble_tracker.h"
+#include "aggregator.h"
+#include "frame.h"
+#include "resolver_task.h"
+#include "rpa_resolver.h"
+#include "rssi_filter.h"
+#include "scan_controller.h"
+#include "trace.h"
+
+namespace esphome {
+namespace irk_resolver {
+
+// Formats an address the same way ESPBTDevice::address_str() does
+std::string format_address(uint64_t address);
+
+// Resolver statistics, copied at one point in time
+struct ResolverStats {
+  uint32_t cache_hits;
+  uint32_t cache_misses;
+  uint32_t mean_rotation_interval_ms;
+};
+
+class IrkResolverComponent : public Component, public esp32_ble_tracker::ESPBTDeviceListener {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  float get_setup_priority() const override;
+
+  bool parse_device(const esp32_ble_tracker::ESPBTDevice &device) override;
+
+  // IRKs compiled in from the irks: option, resolved from the first advert; loaded IRKs extend them
+  void set_static_irks(const StaticIrkTable &irks) { this->resolver_.set_static_irks(irks); }
+  // Replaces the loaded IRK set with a colon-separated list of base64 or hex IRKs
+  void load_irks(const std::string &irks);
+  // Adds and removes individual IRKs; see apply_irk_delta() for the format
+  void apply_delta(const std::string &delta);
+  // IRKs from this node's irk_enrollment store, in load_irks()' format; added again after every load_irks()
+  void set_local_irks(const std::string &irks);
+
+  // Only safe without a resolver task, which changes the resolver at any time; use get_resolver_stats() to read
+  // statistics, and load_irks() and apply_delta() for updates
+  IrkResolver &get_resolver() { return this->resolver_; }
+  // Copied under the resolver task's lock, so it can be called from the main loop with or without a task
+  ResolverStats get_resolver_stats();
+
+  // Resolves on a dedicated task pinned to core, fed through rings of ring_size adverts
+  void set_resolver_task(int core, int priority, size_t ring_size) {
+    this->task_core_ = core;
+    this->task_priority_ = priority;
+    this->task_ring_size_ = ring_size;
+  }
+  // The resolver task, or nullptr when resolving inline
+  ResolverTask *get_resolver_task() { return this->task_.get(); }
+
+  // Records every advertisement seen into a RAM ring of this many records
+  void set_trace(size_t capacity, uint16_t source) {
+    this->trace_capacity_ = capacity;
+    this->trace_source_ = source;
+  }
+  // Writes the recorded trace to the log, a few records per loop(), then clears it
+  void dump_trace();
+
+  void set_irk_prefilter(text_sensor::TextSensor *irk_prefilter) { this->irk_prefilter_ = irk_prefilter; }
+  void add_on_resolved_callback(std::function<void(int, int, uint64_t)> &&callback) {
+    this->resolved_callback_.add(std::move(callback));
+  }
+
+  // Summarizes resolved adverts per identity over windows of this length
+  void set_aggregation_window(uint32_t window_ms) { this->aggregation_window_ms_ = window_ms; }
+  void add_on_first_seen_callback(std::function<void(int, int, uint64_t)> &&callback) {
+    this->first_seen_callback_.add(std::move(callback));
+  }
+  void add_on_window_callback(std::function<void(const BeaconSummary &)> &&callback) {
+    this->window_callback_.add(std::move(callback));
+  }
+
+  // Smooths each identity's RSSI; see RssiFilter
+  void set_rssi_filter(RssiFilterMode mode, uint32_t half_life_ms, float process_noise, float measurement_noise,
+                       float offset) {
+    this->rssi_filter_.reset(new RssiFilter(mode, half_life_ms, process_noise, measurement_noise, offset));
+  }
+  // Filtered RSSI of identity, or NAN without a filter or any samples
+  float get_filtered_rssi(int identity) const {
+    return this->rssi_filter_ != nullptr ? this->rssi_filter_->value(identity) : NAN;
+  }
+
+  // Batches resolved adverts into binary frames, sent when full or when the oldest record is deadline_ms old
+  void set_batch(size_t max_records, uint32_t deadline_ms, uint16_t source) {
+    this->batch_max_records_ = max_records;
+    this->batch_deadline_ms_ = deadline_ms;
+    this->batch_source_ = source;
+  }
+  void add_on_frame_callback(std::function<void(const std::vector<uint8_t> &)> &&callback) {
+    this->frame_callback_.add(std::move(callback));
+  }
+
+  // Adjusts the tracker's scan window every update_interval_ms, keeping its scan interval at interval_ms
+  void set_scan_control(uint32_t interval_ms, uint32_t update_interval_ms, float min_duty, float max_duty, float step,
+                        uint32_t hold_ms, uint32_t nearby_ms, uint32_t max_loop_lag_ms) {
+    this->scan_controller_.reset(new ScanController(min_duty, max_duty, step, hold_ms, nearby_ms, max_loop_lag_ms));
+    this->scan_interval_ms_ = interval_ms;
+    this->scan_update_interval_ms_ = update_interval_ms;
+  }
+  void set_scan_duty_sensor(sensor::Sensor *sensor) { this->scan_duty_sensor_ = sensor; }
+
+#ifdef IRK_RESOLVER_METRICS
+  // Publishes the counters every interval_ms, and the resolve times seen since the last publish
+  void set_metrics_interval(uint32_t interval_ms) { this->metrics_interval_ms_ = interval_ms; }
+  void set_adverts_sensor(sensor::Sensor *sensor) { this->adverts_sensor_ = sensor; }
+  void set_non_rpa_sensor(sensor::Sensor *sensor) { this->non_rpa_sensor_ = sensor; }
+  void set_cache_hits_sensor(sensor::Sensor *sensor) { this->cache_hits_sensor_ = sensor; }
+  void set_cache_misses_sensor(sensor::Sensor *sensor) { this->cache_misses_sensor_ = sensor; }
+  void set_aes_blocks_sensor(sensor::Sensor *sensor) { this->aes_blocks_sensor_ = sensor; }
+  void set_dropped_sensor(sensor::Sensor *sensor) { this->dropped_sensor_ = sensor; }
+  void set_resolve_time_median_sensor(sensor::Sensor *sensor) { this->resolve_time_median_sensor_ = sensor; }
+  void set_resolve_time_p99_sensor(sensor::Sensor *sensor) { this->resolve_time_p99_sensor_ = sensor; }
+#endif
+
+ protected:
+  template<typename F> void with_resolver_(F &&fn) {
+    if (this->task_ != nullptr) {
+      this->task_->with_resolver(fn);
+    } else {
+      fn(this->resolver_);
+    }
+  }
+  // Changes the IRKs; results the task resolved against the old ones are handled first, under the same lock, so
+  // none of them is looked up in a slot that has changed since
+  template<typename F> void update_resolver_(F &&fn) {
+    this->with_resolver_([&](IrkResolver &resolver) {
+      this->handle_task_results_();
+      fn(resolver);
+    });
+  }
+  void handle_task_results_();
+  void handle_resolved_(int identity, int rssi, uint64_t address, uint32_t timestamp_ms);
+
+  IrkResolver resolver_;
+  std::unique_ptr<ResolverTask> task_;
+  int task_core_{0};
+  int task_priority_{1};
+  size_t task_ring_size_{0};
+  text_sensor::TextSensor *irk_prefilter_{nullptr};
+  std::string local_irks_;
+  CallbackManager<void(int, int, uint64_t)> resolved_callback_;
+
+  std::unique_ptr<BeaconAggregator> aggregator_;
+  uint32_t aggregation_window_ms_{0};
+  CallbackManager<void(int, int, uint64_t)> first_seen_callback_;
+  CallbackManager<void(const BeaconSummary &)> window_callback_;
+
+  void send_frame_();
+
+  std::unique_ptr<RssiFilter> rssi_filter_;
+
+  std::unique_ptr<FrameEncoder> batch_;
+  size_t batch_max_records_{0};
+  uint32_t batch_deadline_ms_{0};
+  uint16_t batch_source_{0};
+  CallbackManager<void(const std::vector<uint8_t> &)> frame_callback_;
+
+  void update_scan_duty_();
+
+  std::unique_ptr<ScanController> scan_controller_;
+  uint32_t scan_interval_ms_{0};
+  uint32_t scan_update_interval_ms_{0};
+  // Scan window last given to the tracker, in 0.625 ms units
+  uint32_t scan_window_{0};
+  sensor::Sensor *scan_duty_sensor_{nullptr};
+  // Longest gap between loop() calls since the last duty update
+  uint32_t last_loop_ms_{0};
+  uint32_t loop_lag_ms_{0};
+
+  std::unique_ptr<TraceRecorder> trace_;
+  size_t trace_capacity_{0};
+  uint16_t trace_source_{0};
+  // Next record to dump, or -1 when no dump is in progress
+  int trace_dump_pos_{-1};
+
+#ifdef IRK_RESOLVER_METRICS
+  void publish_metrics_();
+
+  uint32_t metrics_interval_ms_{60000};
+  // Every advert parse_device() was given, and those that weren't RPAs
+  uint32_t adverts_seen_{0};
+  uint32_t non_rpa_{0};
+  sensor::Sensor *adverts_sensor_{nullptr};
+  sensor::Sensor *non_rpa_sensor_{nullptr};
+  sensor::Sensor *cache_hits_sensor_{nullptr};
+  sensor::Sensor *cache_misses_sensor_{nullptr};
+  sensor::Sensor *aes_blocks_sensor_{nullptr};
+  sensor::Sensor *dropped_sensor_{nullptr};
+  sensor::Sensor *resolve_time_median_sensor_{nullptr};
+  sensor::Sensor *resolve_time_p99_sensor_{nullptr};
+#endif
+};
+
+// Fires with the identity index, RSSI and address of every resolved advertisement
+class ResolvedTrigger : public Trigger<int, int, uint64_t> {
+ public:
+  explicit ResolvedTrigger(IrkResolverComponent *parent) {
+    parent->add_on_resolved_callback(
+        [this](int identity, int rssi, uint64_t address) { this->trigger(identity, rssi, address); });
+  }
+};
+
+// Fires with the identity index, RSSI and address of an identity's first advert after a window without any
+class FirstSeenTrigger : public Trigger<int, int, uint64_t> {
+ public:
+  explicit FirstSeenTrigger(IrkResolverComponent *parent) {
+    parent->add_on_first_seen_callback(
+        [this](int identity, int rssi, uint64_t address) { this->trigger(identity, rssi, address); });
+  }
+};
+
+// Fires once per identity per aggregation window that saw any adverts
+class WindowTrigger : public Trigger<const BeaconSummary &> {
+ public:
+  explicit WindowTrigger(IrkResolverComponent *parent) {
+    parent->add_on_window_callback([this](const BeaconSummary &summary) { this->trigger(summary); });
+  }
+};
+
+// Fires with each finished binary frame of resolved adverts
+class FrameTrigger : public Trigger<const std::vector<uint8_t> &> {
+ public:
+  explicit FrameTrigger(IrkResolverComponent *parent) {
+    parent->add_on_frame_callback([this](const std::vector<uint8_t> &frame) { this->trigger(frame); });
+  }
+};
+
+template<typename... Ts> class DumpTraceAction : public Action<Ts...> {
+ public:
+  DumpTraceAction(IrkResolverComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->dump_trace(); }
+
+  IrkResolverComponent *parent_;
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
+
+#endif
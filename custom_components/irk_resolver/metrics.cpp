@@ -0,0 +1,40 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace esphome {
+namespace irk_resolver {
+
+void LatencyHistogram::clear() { memset(this->counts_, 0, sizeof(this->counts_)); }
+
+uint32_t LatencyHistogram::count() const {
+  uint32_t total = 0;
+  for (uint32_t c : this->counts_) {
+    total += c;
+  }
+  return total;
+}
+
+uint32_t LatencyHistogram::quantile_us(float q) const {
+  uint32_t total = this->count();
+  if (total == 0) {
+    return 0;
+  }
+  // the rank of the sample at q, counting from 1
+  uint32_t rank = (uint32_t) std::ceil(q * total);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint32_t seen = 0;
+  for (size_t b = 0; b < BUCKETS; b++) {
+    seen += this->counts_[b];
+    if (seen >= rank) {
+      return bucket_limit_us(b);
+    }
+  }
+  return bucket_limit_us(BUCKETS - 1);
+}
+
+}  // namespace irk_resolver
+}  // namespace esphome
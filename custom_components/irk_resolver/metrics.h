@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef USE_ESP32
+#include <esp_timer.h>
+#else
+#include <chrono>
+#endif
+
+namespace esphome {
+namespace irk_resolver {
+
+// Microsecond clock for timing resolves; wraps, so only differences are meaningful
+inline uint32_t metrics_micros() {
+#ifdef USE_ESP32
+  return (uint32_t) esp_timer_get_time();
+#else
+  return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/*
+ * Durations in power-of-two microsecond buckets: bucket 0 counts anything
+ * below 2 us, bucket b durations in [2^b, 2^(b+1)) us, and the last bucket
+ * everything from about half a second up. Recording is a count-leading-zeros
+ * and an increment.
+ */
+class LatencyHistogram {
+ public:
+  static const size_t BUCKETS = 20;
+
+  void record(uint32_t us) {
+    size_t b = us < 2 ? 0 : 31 - __builtin_clz(us);
+    this->counts_[b < BUCKETS ? b : BUCKETS - 1]++;
+  }
+  void clear();
+
+  uint32_t count() const;
+  uint32_t bucket(size_t b) const { return this->counts_[b]; }
+  // Exclusive upper bound of bucket b in us
+  static uint32_t bucket_limit_us(size_t b) { return 2u << b; }
+  // Upper bound of the bucket holding quantile q (0 to 1), or 0 when empty
+  uint32_t quantile_us(float q) const;
+
+ protected:
+  uint32_t counts_[BUCKETS]{};
+};
+
+/*
+ * What resolving costs, kept by IrkResolver when built with
+ * -DIRK_RESOLVER_METRICS. Without it none of this is compiled in.
+ */
+struct ResolverMetrics {
+  // RPAs passed to resolve()
+  uint32_t rpas{0};
+  // AES-128 block encryptions, 32 per pass of the bitsliced kernel whatever its lanes hold
+  uint32_t aes_blocks{0};
+  // Resolved adverts per identity
+  std::vector<uint32_t> matches;
+  LatencyHistogram resolve_us;
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
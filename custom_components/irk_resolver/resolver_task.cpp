@@ -0,0 +1,109 @@
+#include "resolver_task.h"
+
+namespace esphome {
+namespace irk_resolver {
+
+// Adverts resolved per lock of the resolver, so updates from other threads get a turn
+static const size_t ADVERTS_PER_LOCK = 16;
+// Longest the task sleeps without a notification, which also bounds how long stop() takes
+static const uint32_t WAIT_TIMEOUT_MS = 100;
+
+bool ResolverTask::start(int core, int priority) {
+  if (this->running_.exchange(true)) {
+    return true;
+  }
+#ifdef USE_ESP32
+  if (this->done_ == nullptr) {
+    this->done_ = xSemaphoreCreateBinary();
+    if (this->done_ == nullptr) {
+      this->running_ = false;
+      return false;
+    }
+  }
+  auto entry = [](void *arg) {
+    auto *task = static_cast<ResolverTask *>(arg);
+    task->run_();
+    // Nothing of task is touched after this, so stop() may return and its owner go away
+    xSemaphoreGive(task->done_);
+    vTaskDelete(nullptr);
+  };
+  if (xTaskCreatePinnedToCore(entry, "irk_resolver", 4096, this, priority, &this->handle_, core) != pdPASS) {
+    this->running_ = false;
+    return false;
+  }
+#else
+  (void) core;
+  (void) priority;
+  this->thread_ = std::thread([this]() { this->run_(); });
+#endif
+  return true;
+}
+
+void ResolverTask::stop() {
+  if (!this->running_.exchange(false)) {
+    return;
+  }
+  this->notify_();
+#ifdef USE_ESP32
+  // the task deletes itself once it notices; wait until it has left run_(), as join() does below
+  xSemaphoreTake(this->done_, portMAX_DELAY);
+  this->handle_ = nullptr;
+#else
+  this->thread_.join();
+#endif
+}
+
+bool ResolverTask::submit(uint64_t address, int8_t rssi, uint32_t timestamp_ms) {
+  if (!this->adverts_.push(AdvertRecord{address, timestamp_ms, rssi})) {
+    return false;
+  }
+  this->notify_();
+  return true;
+}
+
+void ResolverTask::run_() {
+  while (this->running_.load(std::memory_order_relaxed)) {
+    if (this->adverts_.empty()) {
+      this->wait_();
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(this->resolver_mutex_);
+    AdvertRecord advert;
+    for (size_t n = 0; n < ADVERTS_PER_LOCK && this->adverts_.pop(&advert); n++) {
+      uint8_t rpa[6];
+      rpa_from_uint64(advert.address, rpa);
+      int identity = this->resolver_.resolve(rpa, advert.timestamp_ms);
+      if (identity >= 0) {
+        this->results_.push(ResolvedRecord{advert.address, advert.timestamp_ms, (int16_t) identity, advert.rssi});
+      }
+      this->processed_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+#ifdef USE_ESP32
+void ResolverTask::wait_() { ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WAIT_TIMEOUT_MS)); }
+
+void ResolverTask::notify_() {
+  if (this->handle_ != nullptr) {
+    xTaskNotifyGive(this->handle_);
+  }
+}
+#else
+void ResolverTask::wait_() {
+  std::unique_lock<std::mutex> lock(this->wake_mutex_);
+  this->wake_.wait_for(lock, std::chrono::milliseconds(WAIT_TIMEOUT_MS), [this]() {
+    return !this->adverts_.empty() || !this->running_.load(std::memory_order_relaxed);
+  });
+}
+
+void ResolverTask::notify_() {
+  // taking the lock orders the notification after the waiter's check, so it can't be lost
+  { std::lock_guard<std::mutex> lock(this->wake_mutex_); }
+  this->wake_.notify_one();
+}
+#endif
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#endif
+
+#include "rpa_resolver.h"
+#include "spsc_ring.h"
+
+namespace esphome {
+namespace irk_resolver {
+
+struct AdvertRecord {
+  uint64_t address;
+  uint32_t timestamp_ms;
+  int8_t rssi;
+};
+
+struct ResolvedRecord {
+  uint64_t address;
+  uint32_t timestamp_ms;
+  int16_t identity;
+  int8_t rssi;
+};
+
+/*
+ * Moves RPA resolution off the thread that receives adverts. Adverts are
+ * submitted into one SPSC ring; a dedicated task resolves them and pushes the
+ * ones that matched into a second ring for the submitting side to poll. On the
+ * ESP32 the task is pinned to a core, normally core 0 at priority 1, below
+ * Wi-Fi and Bluedroid and away from the main loop on core 1; elsewhere it is a
+ * std::thread so the same code can be stress tested on a host.
+ *
+ * submit() and poll() must each be called from a single thread. The resolver
+ * is only touched by the task, or inside with_resolver().
+ */
+class ResolverTask {
+ public:
+  ResolverTask(IrkResolver &resolver, size_t ring_size) : resolver_(resolver), adverts_(ring_size), results_(ring_size) {}
+  ~ResolverTask() { this->stop(); }
+
+  bool start(int core, int priority);
+  void stop();
+
+  // Queues an advert for resolution; false when the ring is full and it was dropped
+  bool submit(uint64_t address, int8_t rssi, uint32_t timestamp_ms);
+  // Takes the next resolved advert
+  bool poll(ResolvedRecord *record) { return this->results_.pop(record); }
+
+  // Runs fn(IrkResolver &) while the task isn't resolving, for updates from another thread
+  template<typename F> void with_resolver(F &&fn) {
+    std::lock_guard<std::mutex> lock(this->resolver_mutex_);
+    fn(this->resolver_);
+  }
+
+  // Adverts waiting to be resolved
+  size_t queued() const { return this->adverts_.size(); }
+  uint32_t processed() const { return this->processed_.load(std::memory_order_relaxed); }
+  uint32_t dropped_adverts() const { return this->adverts_.dropped(); }
+  uint32_t dropped_results() const { return this->results_.dropped(); }
+
+ protected:
+  void run_();
+  // Blocks until notify_() or a timeout
+  void wait_();
+  void notify_();
+
+  IrkResolver &resolver_;
+  std::mutex resolver_mutex_;
+  SpscRing<AdvertRecord> adverts_;
+  SpscRing<ResolvedRecord> results_;
+  std::atomic<bool> running_{false};
+  std::atomic<uint32_t> processed_{0};
+
+#ifdef USE_ESP32
+  TaskHandle_t handle_{nullptr};
+  // Given by the task once it has left run_(), for stop() to wait on
+  SemaphoreHandle_t done_{nullptr};
+#else
+  std::thread thread_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+#endif
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,988 @@
+#include "rpa_resolver.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace esphome {
+namespace irk_resolver {
+
+#ifdef IRK_RESOLVER_HOST_AES
+static void aes_init(AesContext *) {}
+static bool aes_setkey(AesContext *ctx, const uint8_t *key) {
+  host_aes_expand(ctx, key);
+  return true;
+}
+static void aes_free(AesContext *) {}
+
+int bt_encrypt_be(const uint8_t *key, const uint8_t *plaintext, uint8_t *enc_data) {
+  HostAesKey s;
+  host_aes_expand(&s, key);
+  host_aes_encrypt(&s, plaintext, enc_data);
+  return 0;
+}
+
+int bt_encrypt_be(AesContext *ctx, const uint8_t *plaintext, uint8_t *enc_data) {
+  host_aes_encrypt(ctx, plaintext, enc_data);
+  return 0;
+}
+#else
+static void aes_init(AesContext *ctx) { mbedtls_aes_init(ctx); }
+static bool aes_setkey(AesContext *ctx, const uint8_t *key) { return mbedtls_aes_setkey_enc(ctx, key, 128) == 0; }
+static void aes_free(AesContext *ctx) { mbedtls_aes_free(ctx); }
+
+int bt_encrypt_be(const uint8_t *key, const uint8_t *plaintext, uint8_t *enc_data) {
+  mbedtls_aes_context s = {
+    0
+#ifdef USE_ESP_IDF
+    , 0, 0
+#endif
+  };
+  mbedtls_aes_init(&s);
+
+  if (mbedtls_aes_setkey_enc(&s, key, 128) != 0) {
+    mbedtls_aes_free(&s);
+    return -1;
+  }
+
+  if (mbedtls_aes_crypt_ecb(&s,
+#ifdef USE_ESP_IDF
+        ESP_AES_ENCRYPT,
+#else
+        MBEDTLS_AES_ENCRYPT,
+#endif
+        plaintext, enc_data) != 0) {
+    mbedtls_aes_free(&s);
+    return -1;
+  }
+
+  mbedtls_aes_free(&s);
+  return 0;
+}
+
+int bt_encrypt_be(AesContext *ctx, const uint8_t *plaintext, uint8_t *enc_data) {
+  return mbedtls_aes_crypt_ecb(ctx,
+#ifdef USE_ESP_IDF
+        ESP_AES_ENCRYPT,
+#else
+        MBEDTLS_AES_ENCRYPT,
+#endif
+        plaintext, enc_data) != 0 ? -1 : 0;
+}
+#endif
+
+struct encryption_block {
+  uint8_t key[16];
+  uint8_t plain_text[16];
+  uint8_t cipher_text[16];
+};
+
+bool ble_ll_resolv_rpa(const uint8_t *rpa, const uint8_t *irk) {
+  struct encryption_block ecb;
+
+  auto irk32 = (const uint32_t *)irk;
+  auto key32 = (uint32_t *)&ecb.key[0];
+
+  key32[0] = irk32[0];
+  key32[1] = irk32[1];
+  key32[2] = irk32[2];
+  key32[3] = irk32[3];
+
+  ble_ll_rpa_plain_text(rpa, ecb.plain_text);
+
+  if (bt_encrypt_be(ecb.key, ecb.plain_text, ecb.cipher_text)) {
+    return false;
+  }
+
+  if (!ble_ll_rpa_hash_matches(rpa, ecb.cipher_text)) return false;
+
+  return true;
+}
+
+bool ble_ll_resolv_rpa(const uint8_t *rpa, AesContext *ctx) {
+  uint8_t plain_text[16];
+  uint8_t cipher_text[16];
+
+  ble_ll_rpa_plain_text(rpa, plain_text);
+
+  if (bt_encrypt_be(ctx, plain_text, cipher_text)) {
+    return false;
+  }
+
+  return ble_ll_rpa_hash_matches(rpa, cipher_text);
+}
+
+static void bitsliced_sbox(uint32_t *q) {
+  uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+  uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+  uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+  uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19, t20, t21, t22, t23;
+  uint32_t t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39, t40, t41, t42, t43, t44, t45;
+  uint32_t t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59, t60, t61, t62, t63, t64, t65, t66, t67;
+  uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+  x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+  // Top linear transformation
+  y14 = x3 ^ x5; y13 = x0 ^ x6; y9 = x0 ^ x3; y8 = x0 ^ x5;
+  t0 = x1 ^ x2; y1 = t0 ^ x7; y4 = y1 ^ x3; y12 = y13 ^ y14;
+  y2 = y1 ^ x0; y5 = y1 ^ x6; y3 = y5 ^ y8; t1 = x4 ^ y12;
+  y15 = t1 ^ x5; y20 = t1 ^ x1; y6 = y15 ^ x7; y10 = y15 ^ t0;
+  y11 = y20 ^ y9; y7 = x7 ^ y11; y17 = y10 ^ y11; y19 = y10 ^ y8;
+  y16 = t0 ^ y11; y21 = y13 ^ y16; y18 = x0 ^ y16;
+
+  // Non-linear section
+  t2 = y12 & y15; t3 = y3 & y6; t4 = t3 ^ t2; t5 = y4 & x7;
+  t6 = t5 ^ t2; t7 = y13 & y16; t8 = y5 & y1; t9 = t8 ^ t7;
+  t10 = y2 & y7; t11 = t10 ^ t7; t12 = y9 & y11; t13 = y14 & y17;
+  t14 = t13 ^ t12; t15 = y8 & y10; t16 = t15 ^ t12; t17 = t4 ^ t14;
+  t18 = t6 ^ t16; t19 = t9 ^ t14; t20 = t11 ^ t16; t21 = t17 ^ y20;
+  t22 = t18 ^ y19; t23 = t19 ^ y21; t24 = t20 ^ y18;
+  t25 = t21 ^ t22; t26 = t21 & t23; t27 = t24 ^ t26; t28 = t25 & t27;
+  t29 = t28 ^ t22; t30 = t23 ^ t24; t31 = t22 ^ t26; t32 = t31 & t30;
+  t33 = t32 ^ t24; t34 = t23 ^ t33; t35 = t27 ^ t33; t36 = t24 & t35;
+  t37 = t36 ^ t34; t38 = t27 ^ t36; t39 = t29 & t38; t40 = t25 ^ t39;
+  t41 = t40 ^ t37; t42 = t29 ^ t33; t43 = t29 ^ t40; t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15; z1 = t37 & y6; z2 = t33 & x7; z3 = t43 & y16;
+  z4 = t40 & y1; z5 = t29 & y7; z6 = t42 & y11; z7 = t45 & y17;
+  z8 = t41 & y10; z9 = t44 & y12; z10 = t37 & y3; z11 = t33 & y4;
+  z12 = t43 & y13; z13 = t40 & y5; z14 = t29 & y2; z15 = t42 & y9;
+  z16 = t45 & y14; z17 = t41 & y8;
+
+  // Bottom linear transformation
+  t46 = z15 ^ z16; t47 = z10 ^ z11; t48 = z5 ^ z13; t49 = z9 ^ z10;
+  t50 = z2 ^ z12; t51 = z2 ^ z5; t52 = z7 ^ z8; t53 = z0 ^ z3;
+  t54 = z6 ^ z7; t55 = z16 ^ z17; t56 = z12 ^ t48; t57 = t50 ^ t53;
+  t58 = z4 ^ t46; t59 = z3 ^ t54; t60 = t46 ^ t57; t61 = z14 ^ t57;
+  t62 = t52 ^ t58; t63 = t49 ^ t58; t64 = z4 ^ t59; t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63; s6 = t56 ^ ~t62; s7 = t48 ^ ~t60; t67 = t64 ^ t65;
+  s3 = t53 ^ t66; s4 = t51 ^ t66; s5 = t47 ^ t65; s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+  q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+// Multiplies a bitsliced byte by x in GF(2^8)
+static inline void bitsliced_xtime(const uint32_t *a, uint32_t *out) {
+  out[0] = a[7];
+  out[1] = a[0] ^ a[7];
+  out[2] = a[1];
+  out[3] = a[2] ^ a[7];
+  out[4] = a[3] ^ a[7];
+  out[5] = a[4];
+  out[6] = a[5];
+  out[7] = a[6];
+}
+
+static void bitsliced_mix_columns(uint32_t (*st)[8]) {
+  for (int c = 0; c < 16; c += 4) {
+    uint32_t *a0 = st[c], *a1 = st[c + 1], *a2 = st[c + 2], *a3 = st[c + 3];
+    uint32_t all[8], d0[8], d1[8], d2[8], d3[8], x[8];
+    for (int b = 0; b < 8; b++) {
+      all[b] = a0[b] ^ a1[b] ^ a2[b] ^ a3[b];
+      d0[b] = a0[b] ^ a1[b];
+      d1[b] = a1[b] ^ a2[b];
+      d2[b] = a2[b] ^ a3[b];
+      d3[b] = a3[b] ^ a0[b];
+    }
+    bitsliced_xtime(d0, x);
+    for (int b = 0; b < 8; b++) a0[b] ^= all[b] ^ x[b];
+    bitsliced_xtime(d1, x);
+    for (int b = 0; b < 8; b++) a1[b] ^= all[b] ^ x[b];
+    bitsliced_xtime(d2, x);
+    for (int b = 0; b < 8; b++) a2[b] ^= all[b] ^ x[b];
+    bitsliced_xtime(d3, x);
+    for (int b = 0; b < 8; b++) a3[b] ^= all[b] ^ x[b];
+  }
+}
+
+// Byte i of the state after ShiftRows comes from byte bitsliced_shift_rows_src[i]
+static const uint8_t bitsliced_shift_rows_src[16] = {0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11};
+
+void bitsliced_set_irk(BitslicedIrkBatch &batch, size_t lane, const uint8_t *irk) {
+  uint32_t bit = 1UL << lane;
+  for (int i = 0; i < 16; i++) {
+    for (int b = 0; b < 8; b++) {
+      if ((irk[i] >> b) & 1) {
+        batch.rk[0][i][b] |= bit;
+      } else {
+        batch.rk[0][i][b] &= ~bit;
+      }
+    }
+  }
+  batch.lanes |= bit;
+}
+
+void bitsliced_expand_keys(BitslicedIrkBatch &batch) {
+  uint8_t rcon = 0x01;
+  for (int r = 1; r <= 10; r++) {
+    auto &prev = batch.rk[r - 1];
+    auto &cur = batch.rk[r];
+    uint32_t temp[4][8];
+    // RotWord then SubWord on the last word of the previous round key
+    for (int i = 0; i < 4; i++) {
+      memcpy(temp[i], prev[12 + ((i + 1) & 3)], sizeof(temp[i]));
+      bitsliced_sbox(temp[i]);
+    }
+    for (int b = 0; b < 8; b++) {
+      if ((rcon >> b) & 1) {
+        temp[0][b] = ~temp[0][b];
+      }
+    }
+    for (int i = 0; i < 16; i++) {
+      for (int b = 0; b < 8; b++) {
+        cur[i][b] = prev[i][b] ^ (i < 4 ? temp[i][b] : cur[i - 4][b]);
+      }
+    }
+    rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0);
+  }
+}
+
+int resolve_rpa_batch(const uint8_t *rpa, const BitslicedIrkBatch *table, size_t num_batches) {
+  uint8_t plain_text[16];
+  ble_ll_rpa_plain_text(rpa, plain_text);
+
+  for (size_t n = 0; n < num_batches; n++) {
+    const BitslicedIrkBatch &batch = table[n];
+    uint32_t st[16][8];
+    uint32_t tmp[16][8];
+
+    for (int i = 0; i < 16; i++) {
+      for (int b = 0; b < 8; b++) {
+        st[i][b] = batch.rk[0][i][b] ^ (((plain_text[i] >> b) & 1) ? 0xffffffffUL : 0);
+      }
+    }
+
+    for (int r = 1; r < 10; r++) {
+      for (int i = 0; i < 16; i++) {
+        bitsliced_sbox(st[i]);
+      }
+      for (int i = 0; i < 16; i++) {
+        memcpy(tmp[i], st[bitsliced_shift_rows_src[i]], sizeof(tmp[i]));
+      }
+      bitsliced_mix_columns(tmp);
+      for (int i = 0; i < 16; i++) {
+        for (int b = 0; b < 8; b++) {
+          st[i][b] = tmp[i][b] ^ batch.rk[r][i][b];
+        }
+      }
+    }
+
+    // Last round, for cipher text bytes 13..15 only; they hold rpa[2], rpa[1] and rpa[0]
+    uint32_t match = batch.lanes;
+    for (int i = 13; i < 16; i++) {
+      uint32_t *q = tmp[i];
+      memcpy(q, st[bitsliced_shift_rows_src[i]], sizeof(tmp[i]));
+      bitsliced_sbox(q);
+      uint8_t expected = rpa[15 - i];
+      for (int b = 0; b < 8; b++) {
+        uint32_t ct = q[b] ^ batch.rk[10][i][b];
+        match &= ((expected >> b) & 1) ? ct : ~ct;
+      }
+    }
+
+    if (match != 0) {
+      return n * BITSLICED_LANES + __builtin_ctz(match);
+    }
+  }
+  return -1;
+}
+
+int RpaCache::lookup(uint64_t addr) {
+  size_t slot = home_slot(addr);
+  for (size_t i = 0; i < MAX_PROBE; i++, slot = (slot + 1) & (SIZE - 1)) {
+    uint64_t e = this->entries_[slot];
+    if (e == 0) {
+      break;
+    }
+    if ((e & ADDR_MASK) == addr) {
+      this->hits_++;
+      return (int) (e >> 48) - 2;
+    }
+  }
+  this->misses_++;
+  return MISS;
+}
+
+void RpaCache::insert(uint64_t addr, int index) {
+  uint64_t entry = addr | ((uint64_t) (index + 2) << 48);
+  size_t home = home_slot(addr);
+  size_t slot = home;
+  for (size_t i = 0; i < MAX_PROBE; i++, slot = (slot + 1) & (SIZE - 1)) {
+    uint64_t e = this->entries_[slot];
+    if (e == 0 || (e & ADDR_MASK) == addr) {
+      this->entries_[slot] = entry;
+      return;
+    }
+  }
+  this->entries_[home] = entry;
+}
+
+void RpaCache::erase(uint64_t addr) {
+  size_t slot = home_slot(addr);
+  for (size_t i = 0; i < MAX_PROBE; i++, slot = (slot + 1) & (SIZE - 1)) {
+    if ((this->entries_[slot] & ADDR_MASK) == addr) {
+      this->entries_[slot] = 0;
+      return;
+    }
+  }
+}
+
+void RpaCache::forget(int index) {
+  uint64_t tag = (uint64_t) (index + 2) << 48;
+  for (auto &e : this->entries_) {
+    if ((e & ~ADDR_MASK) == tag) {
+      e = (e & ADDR_MASK) | ((uint64_t) (NO_MATCH + 2) << 48);
+    }
+  }
+}
+
+int IdentityTable::lookup(uint64_t addr, uint32_t now_ms) {
+  for (size_t i = 0; i < this->count_; i++) {
+    if (this->addresses_[i] == addr) {
+      this->states_[i].last_seen_ms = now_ms;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void IdentityTable::seen(size_t identity, uint64_t addr, uint32_t now_ms) {
+  auto &state = this->states_[identity];
+  uint64_t &current = this->addresses_[identity];
+  if (current == 0) {
+    state.first_seen_ms = now_ms;
+  } else if (current != addr) {
+    // unsigned, so the interval survives a millis() wrap
+    state.rotation_interval_ms = now_ms - state.rotated_ms;
+    state.rotations++;
+  }
+  if (current != addr) {
+    current = addr;
+    state.rotated_ms = now_ms;
+  }
+  state.last_seen_ms = now_ms;
+}
+
+void IdentityTable::reset(size_t identity) {
+  this->addresses_[identity] = 0;
+  memset(&this->states_[identity], 0, sizeof(IdentityState));
+}
+
+void IdentityTable::resize(size_t count) {
+  if (count > this->capacity_) {
+    size_t capacity = std::max(count, this->capacity_ * 2);
+    std::unique_ptr<uint64_t[]> addresses(new uint64_t[capacity]);
+    std::unique_ptr<IdentityState[]> states(new IdentityState[capacity]);
+    if (this->count_ > 0) {
+      memcpy(addresses.get(), this->addresses_.get(), this->count_ * sizeof(uint64_t));
+      memcpy(states.get(), this->states_.get(), this->count_ * sizeof(IdentityState));
+    }
+    this->addresses_ = std::move(addresses);
+    this->states_ = std::move(states);
+    this->capacity_ = capacity;
+  }
+  size_t old_count = this->count_;
+  this->count_ = count;
+  for (size_t i = old_count; i < count; i++) {
+    this->reset(i);
+  }
+}
+
+uint32_t IdentityTable::mean_rotation_interval_ms() const {
+  uint64_t total = 0;
+  uint32_t n = 0;
+  for (size_t i = 0; i < this->count_; i++) {
+    if (this->states_[i].rotation_interval_ms != 0) {
+      total += this->states_[i].rotation_interval_ms;
+      n++;
+    }
+  }
+  return n == 0 ? 0 : total / n;
+}
+
+void IrkTable::clear() {
+  this->count_ = 0;
+  this->live_ = 0;
+}
+
+void IrkTable::copy_from(const IrkTable &other) {
+  if (this->capacity_ < other.count_) {
+    this->grow_(other.capacity_);
+  }
+  for (size_t i = 0; i < other.count_; i++) {
+    bool differs = i >= this->count_ || this->is_live(i) != other.is_live(i) ||
+                   memcmp(this->keys_[i].key, other.keys_[i].key, 16) != 0;
+    if (differs) {
+      memcpy(this->keys_[i].key, other.keys_[i].key, 16);
+      this->flags_[i] = other.flags_[i] | SLOT_DIRTY;
+    } else {
+      this->flags_[i] = (this->flags_[i] & SLOT_DIRTY) | (other.flags_[i] & ~SLOT_DIRTY);
+    }
+  }
+  this->count_ = other.count_;
+  this->live_ = other.live_;
+}
+
+void IrkTable::add(const uint8_t *irk, uint8_t source) { memcpy(this->append(source), irk, 16); }
+
+uint8_t *IrkTable::append(uint8_t source) {
+  if (this->count_ == this->capacity_) {
+    this->grow_(this->capacity_ == 0 ? 8 : this->capacity_ * 2);
+  }
+  this->flags_[this->count_] = SLOT_LIVE | SLOT_DIRTY | source;
+  this->live_++;
+  return this->keys_[this->count_++].key;
+}
+
+void IrkTable::pop() {
+  this->count_--;
+  this->live_--;
+}
+
+void IrkTable::remove(size_t i) {
+  if (!this->is_live(i)) {
+    return;
+  }
+  memset(this->keys_[i].key, 0, 16);
+  this->flags_[i] = SLOT_DIRTY;
+  this->live_--;
+}
+
+bool IrkTable::remove_source(size_t i, uint8_t source) {
+  this->flags_[i] &= ~source;
+  if (this->sources(i) != 0) {
+    return false;
+  }
+  this->remove(i);
+  return true;
+}
+
+int IrkTable::find(const uint8_t *irk) const {
+  for (size_t i = 0; i < this->count_; i++) {
+    if (this->is_live(i) && memcmp(this->keys_[i].key, irk, 16) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool IrkTable::expand() {
+  bool ok = true;
+#ifdef IRK_RESOLVER_BITSLICED
+  for (size_t n = 0; n < this->num_batches_(); n++) {
+    // a batch is rebuilt whole, also when slots past the end of the table are still set in it
+    size_t first = n * BITSLICED_LANES, last = std::min(first + BITSLICED_LANES, this->count_);
+    uint32_t lanes = 0;
+    bool dirty = false;
+    for (size_t i = first; i < last; i++) {
+      if (this->is_live(i)) {
+        lanes |= 1UL << (i - first);
+      }
+      dirty |= (this->flags_[i] & SLOT_DIRTY) != 0;
+      this->flags_[i] &= ~SLOT_DIRTY;
+    }
+    auto &batch = this->batches_[n];
+    if (!dirty && batch.lanes == lanes) {
+      continue;
+    }
+    batch.lanes = 0;
+    for (size_t i = first; i < last; i++) {
+      if (this->is_live(i)) {
+        bitsliced_set_irk(batch, i - first, this->keys_[i].key);
+      }
+    }
+    bitsliced_expand_keys(batch);
+  }
+#else
+  for (size_t i = 0; i < this->count_; i++) {
+    auto &sched = this->schedules_[i];
+    if (this->flags_[i] & SLOT_DIRTY) {
+      sched.valid = this->is_live(i) && aes_setkey(&sched.ctx, this->keys_[i].key);
+      this->flags_[i] &= ~SLOT_DIRTY;
+    }
+    if (this->is_live(i) && !sched.valid) {
+      ok = false;
+    }
+  }
+#endif
+  return ok;
+}
+
+int IrkTable::resolve(const uint8_t *rpa, uint32_t *aes_blocks) const {
+#ifdef IRK_RESOLVER_BITSLICED
+  int found = resolve_rpa_batch(rpa, this->batches_.get(), this->num_batches_());
+  if (aes_blocks != nullptr) {
+    // every lane of each batch up to the matching one is encrypted
+    *aes_blocks += (found >= 0 ? found / BITSLICED_LANES + 1 : this->num_batches_()) * BITSLICED_LANES;
+  }
+  return found;
+#else
+  int found = -1;
+  uint32_t blocks = 0;
+  for (size_t i = 0; i < this->count_; i++) {
+    auto &sched = this->schedules_[i];
+    if (!sched.valid) {
+      continue;
+    }
+    blocks++;
+    if (ble_ll_resolv_rpa(rpa, &sched.ctx)) {
+      found = i;
+      break;
+    }
+  }
+  if (aes_blocks != nullptr) {
+    *aes_blocks += blocks;
+  }
+  return found;
+#endif
+}
+
+void IrkTable::grow_(size_t capacity) {
+#ifdef IRK_RESOLVER_BITSLICED
+  // keep whole batches so every lane of the last batch is addressable
+  capacity = (capacity + BITSLICED_LANES - 1) / BITSLICED_LANES * BITSLICED_LANES;
+#endif
+  std::unique_ptr<Irk[]> keys(new Irk[capacity]);
+  std::unique_ptr<uint8_t[]> flags(new uint8_t[capacity]);
+  size_t count = this->count_, live = this->live_;
+  for (size_t i = 0; i < count; i++) {
+    memcpy(keys[i].key, this->keys_[i].key, 16);
+    // the schedules are reallocated below, so every slot needs expanding again
+    flags[i] = this->flags_[i] | SLOT_DIRTY;
+  }
+  this->release_();
+  this->keys_ = std::move(keys);
+  this->flags_ = std::move(flags);
+  this->capacity_ = capacity;
+  this->count_ = count;
+  this->live_ = live;
+#ifdef IRK_RESOLVER_BITSLICED
+  this->batches_.reset(new BitslicedIrkBatch[capacity / BITSLICED_LANES]);
+  memset(this->batches_.get(), 0, capacity / BITSLICED_LANES * sizeof(BitslicedIrkBatch));
+#else
+  this->schedules_.reset(new IrkSchedule[capacity]);
+  for (size_t i = 0; i < capacity; i++) {
+    aes_init(&this->schedules_[i].ctx);
+    this->schedules_[i].valid = false;
+  }
+#endif
+}
+
+void IrkTable::release_() {
+#ifndef IRK_RESOLVER_BITSLICED
+  for (size_t i = 0; i < this->capacity_; i++) {
+    aes_free(&this->schedules_[i].ctx);
+  }
+  this->schedules_.reset();
+#else
+  this->batches_.reset();
+#endif
+  this->keys_.reset();
+  this->flags_.reset();
+  this->capacity_ = 0;
+  this->count_ = 0;
+  this->live_ = 0;
+}
+
+IrkTable &IrkResolver::begin_update() {
+  IrkTable *staging = this->staging_();
+  staging->clear();
+  return *staging;
+}
+
+IrkTable &IrkResolver::begin_delta() {
+  IrkTable *staging = this->staging_();
+  staging->copy_from(*this->published_.load(std::memory_order_relaxed));
+  return *staging;
+}
+
+bool IrkResolver::publish() {
+  IrkTable *staging = this->staging_();
+  IrkTable *before = this->published_.load(std::memory_order_relaxed);
+  // a static IRK would always resolve first, so its copy in the table would only cost AES work
+  for (size_t i = 0; i < staging->size() && this->static_.count > 0; i++) {
+    if (!staging->is_live(i)) {
+      continue;
+    }
+    for (size_t s = 0; s < this->static_.count; s++) {
+      if (memcmp(staging->irks()[i].key, this->static_.keys[s].key, 16) == 0) {
+        staging->remove(i);
+        break;
+      }
+    }
+  }
+  bool ok = staging->expand();
+  this->published_.store(staging, std::memory_order_release);
+  this->identities_.resize(this->static_.count + staging->size());
+#ifdef IRK_RESOLVER_METRICS
+  this->metrics_.matches.resize(this->static_.count + staging->size());
+#endif
+  this->patch_cache_(*before, *staging);
+  return ok;
+}
+
+void IrkResolver::set_static_irks(const StaticIrkTable &irks) {
+  this->static_ = irks;
+#ifndef IRK_RESOLVER_BITSLICED
+  this->static_table_.clear();
+  for (size_t i = 0; i < irks.count; i++) {
+    this->static_table_.add(irks.keys[i].key);
+  }
+  this->static_table_.expand();
+#endif
+  this->identities_.resize(irks.count + this->table().size());
+#ifdef IRK_RESOLVER_METRICS
+  this->metrics_.matches.resize(irks.count + this->table().size());
+#endif
+}
+
+void IrkResolver::patch_cache_(const IrkTable &before, const IrkTable &after) {
+  // Slots whose IRK changed: forgotten ones first, then the added ones checked in index order, so
+  // that an address still ends up with the lowest index that resolves it. Static identities never change.
+  size_t base = this->static_.count;
+  size_t added[MAX_CACHE_PATCH];
+  size_t num_added = 0, num_changed = 0;
+  size_t slots = std::max(before.size(), after.size());
+  for (size_t i = 0; i < slots; i++) {
+    bool was = i < before.size() && before.is_live(i);
+    bool is = i < after.size() && after.is_live(i);
+    if (was && is && memcmp(before.irks()[i].key, after.irks()[i].key, 16) == 0) {
+      continue;
+    }
+    if (!was && !is) {
+      continue;
+    }
+    if (++num_changed > MAX_CACHE_PATCH) {
+      this->cache_.flush();
+      for (size_t identity = base; identity < this->identities_.size(); identity++) {
+        this->identities_.reset(identity);
+      }
+#ifdef IRK_RESOLVER_METRICS
+      std::fill(this->metrics_.matches.begin() + base, this->metrics_.matches.end(), 0);
+#endif
+      return;
+    }
+    if (was) {
+      this->cache_.forget(base + i);
+      if (base + i < this->identities_.size()) {
+        this->identities_.reset(base + i);
+      }
+#ifdef IRK_RESOLVER_METRICS
+      if (base + i < this->metrics_.matches.size()) {
+        this->metrics_.matches[base + i] = 0;
+      }
+#endif
+    }
+    if (is) {
+      added[num_added++] = i;
+    }
+  }
+
+  for (size_t n = 0; n < num_added; n++) {
+    // an IRK whose key can't be expanded never resolves, so its NO_MATCH entries stay right
+    AesContext ctx;
+    aes_init(&ctx);
+    if (aes_setkey(&ctx, after.irks()[added[n]].key)) {
+      this->cache_.rematch([&](uint64_t addr) {
+        uint8_t rpa[6];
+        rpa_from_uint64(addr, rpa);
+        return ble_ll_resolv_rpa(rpa, &ctx) ? (int) (base + added[n]) : RpaCache::NO_MATCH;
+      });
+    }
+    aes_free(&ctx);
+  }
+}
+
+const uint8_t *IrkResolver::irk(size_t identity) const {
+  if (identity < this->static_.count) {
+    return this->static_.keys[identity].key;
+  }
+  const IrkTable &table = this->table();
+  size_t slot = identity - this->static_.count;
+  return slot < table.size() && table.is_live(slot) ? table.irks()[slot].key : nullptr;
+}
+
+int IrkResolver::resolve(const uint8_t *rpa, uint32_t now_ms) {
+#ifdef IRK_RESOLVER_METRICS
+  uint32_t start = metrics_micros();
+  int found = this->resolve_(rpa, now_ms);
+  this->metrics_.resolve_us.record(metrics_micros() - start);
+  this->metrics_.rpas++;
+  if (found >= 0 && (size_t) found < this->metrics_.matches.size()) {
+    this->metrics_.matches[found]++;
+  }
+  return found;
+#else
+  return this->resolve_(rpa, now_ms);
+#endif
+}
+
+int IrkResolver::resolve_(const uint8_t *rpa, uint32_t now_ms) {
+  uint64_t addr = rpa_to_uint64(rpa);
+  int found = this->identities_.lookup(addr, now_ms);
+  if (found >= 0) {
+    this->identity_hits_++;
+    return found;
+  }
+
+  // Resolved addresses live in the identity table only, so that a rotated-out RPA can't come back from the
+  // cache; the cache only holds an index for an entry rematched when its IRK was added
+  found = this->cache_.lookup(addr);
+  if (found >= 0) {
+    this->cache_.erase(addr);
+  } else if (found == RpaCache::MISS) {
+#ifdef IRK_RESOLVER_BITSLICED
+    size_t static_batches = (this->static_.count + BITSLICED_LANES - 1) / BITSLICED_LANES;
+    found = static_batches > 0 ? resolve_rpa_batch(rpa, this->static_.batches, static_batches) : -1;
+#ifdef IRK_RESOLVER_METRICS
+    this->metrics_.aes_blocks += (found >= 0 ? found / BITSLICED_LANES + 1 : static_batches) * BITSLICED_LANES;
+#endif
+#elif defined(IRK_RESOLVER_METRICS)
+    found = this->static_.count > 0 ? this->static_table_.resolve(rpa, &this->metrics_.aes_blocks) : -1;
+#else
+    found = this->static_.count > 0 ? this->static_table_.resolve(rpa) : -1;
+#endif
+#ifdef IRK_RESOLVER_METRICS
+    if (found < 0) {
+      found = this->published_.load(std::memory_order_acquire)->resolve(rpa, &this->metrics_.aes_blocks);
+#else
+    if (found < 0) {
+      found = this->published_.load(std::memory_order_acquire)->resolve(rpa);
+#endif
+      if (found >= 0) {
+        found += this->static_.count;
+      }
+    }
+    if (found < 0) {
+      this->cache_.insert(addr, RpaCache::NO_MATCH);
+    }
+  }
+  if (found >= 0) {
+    this->identities_.seen(found, addr, now_ms);
+  }
+  return found;
+}
+
+IrkTable *IrkResolver::staging_() {
+  IrkTable *published = this->published_.load(std::memory_order_relaxed);
+  return published == &this->tables_[0] ? &this->tables_[1] : &this->tables_[0];
+}
+
+static int base64_value(char c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static bool decode_base64_irk(std::string_view entry, uint8_t *out) {
+  if (entry.size() == 24) {
+    if (entry[22] != '=' || entry[23] != '=')
+      return false;
+    entry = entry.substr(0, 22);
+  }
+  if (entry.size() != 22)
+    return false;
+
+  uint32_t acc = 0;
+  int bits = 0;
+  size_t n = 0;
+  for (char c : entry) {
+    int v = base64_value(c);
+    if (v < 0)
+      return false;
+    acc = (acc << 6) | v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out[n++] = (acc >> bits) & 0xff;
+    }
+  }
+  // 22 digits carry 132 bits; the 4 left over must be zero padding
+  return (acc & 0xf) == 0;
+}
+
+static bool decode_hex_irk(std::string_view entry, uint8_t *out) {
+  for (size_t i = 0; i < 16; i++) {
+    int hi = hex_value(entry[2 * i]);
+    int lo = hex_value(entry[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    out[i] = (hi << 4) | lo;
+  }
+  return true;
+}
+
+static bool decode_irk(std::string_view entry, uint8_t *out) {
+  return entry.size() == 32 ? decode_hex_irk(entry, out) : decode_base64_irk(entry, out);
+}
+
+static bool decode_generation(std::string_view digits, uint32_t *generation) {
+  if (digits.empty() || digits.size() > 9)
+    return false;
+  uint32_t value = 0;
+  for (char c : digits) {
+    if (c < '0' || c > '9')
+      return false;
+    value = value * 10 + (c - '0');
+  }
+  *generation = value;
+  return true;
+}
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+// Returns the next non-empty, whitespace-trimmed entry of a colon-separated list, or an empty view at the end
+static std::string_view next_entry(std::string_view list, size_t &pos) {
+  while (pos <= list.size()) {
+    size_t end = list.find(':', pos);
+    if (end == std::string_view::npos)
+      end = list.size();
+
+    size_t first = pos, last = end;
+    while (first < last && is_space(list[first]))
+      first++;
+    while (last > first && is_space(list[last - 1]))
+      last--;
+    pos = end + 1;
+    if (last > first)
+      return list.substr(first, last - first);
+  }
+  return {};
+}
+
+IrkListParseResult parse_irk_list(std::string_view irks, IrkTable &table) {
+  IrkListParseResult result{0, 0, 0};
+  size_t pos = 0;
+  for (std::string_view entry; !(entry = next_entry(irks, pos)).empty();) {
+    if (entry[0] == '@') {
+      if (!decode_generation(entry.substr(1), &result.generation))
+        result.rejected++;
+      continue;
+    }
+
+    uint8_t *key = table.append();
+    if (decode_irk(entry, key)) {
+      result.loaded++;
+    } else {
+      table.pop();
+      result.rejected++;
+    }
+  }
+  return result;
+}
+
+IrkDeltaResult apply_irk_delta(std::string_view delta, IrkResolver &resolver) {
+  IrkDeltaResult result{0, 0, 0, false};
+  size_t pos = 0;
+  std::string_view entry = next_entry(delta, pos);
+
+  uint32_t generation = 0;
+  if (!entry.empty() && entry[0] == '@') {
+    if (!decode_generation(entry.substr(1), &generation) || generation != resolver.generation() + 1) {
+      result.stale = true;
+      return result;
+    }
+    entry = next_entry(delta, pos);
+  }
+
+  auto &table = resolver.begin_delta();
+  for (; !entry.empty(); entry = next_entry(delta, pos)) {
+    uint8_t irk[16];
+    if ((entry[0] != '+' && entry[0] != '-') || !decode_irk(entry.substr(1), irk)) {
+      result.rejected++;
+      continue;
+    }
+
+    int slot = table.find(irk);
+    if (entry[0] == '+' && slot < 0) {
+      table.add(irk);
+      result.added++;
+    } else if (entry[0] == '+') {
+      table.add_source(slot, IrkTable::SOURCE_LOADED);
+    } else if (slot >= 0 && table.remove_source(slot, IrkTable::SOURCE_LOADED)) {
+      result.removed++;
+    }
+  }
+
+  resolver.publish();
+  if (generation != 0) {
+    resolver.set_generation(generation);
+  }
+  return result;
+}
+
+static bool irk_less(const Irk &a, const Irk &b) { return memcmp(a.key, b.key, 16) < 0; }
+
+// Decodes the IRKs of a list into irks, sorted and without duplicates; returns the number of malformed entries
+static size_t decode_sorted_irks(std::string_view list, std::vector<Irk> &irks) {
+  size_t rejected = 0, pos = 0;
+  for (std::string_view entry; !(entry = next_entry(list, pos)).empty();) {
+    if (entry[0] == '@')
+      continue;
+    Irk irk;
+    if (decode_irk(entry, irk.key)) {
+      irks.push_back(irk);
+    } else {
+      rejected++;
+    }
+  }
+  std::sort(irks.begin(), irks.end(), irk_less);
+  irks.erase(std::unique(irks.begin(), irks.end(),
+                         [](const Irk &a, const Irk &b) { return memcmp(a.key, b.key, 16) == 0; }),
+             irks.end());
+  return rejected;
+}
+
+IrkDeltaResult merge_irk_list(std::string_view before, std::string_view after, IrkTable &table) {
+  IrkDeltaResult result{0, 0, 0, false};
+  std::vector<Irk> old_irks, new_irks;
+  decode_sorted_irks(before, old_irks);
+  result.rejected = decode_sorted_irks(after, new_irks);
+
+  std::vector<Irk> dropped;
+  std::set_difference(old_irks.begin(), old_irks.end(), new_irks.begin(), new_irks.end(), std::back_inserter(dropped),
+                      irk_less);
+  for (const Irk &irk : dropped) {
+    int slot = table.find(irk.key);
+    if (slot >= 0 && table.remove_source(slot, IrkTable::SOURCE_LOCAL)) {
+      result.removed++;
+    }
+  }
+
+  for (const Irk &irk : new_irks) {
+    int slot = table.find(irk.key);
+    if (slot < 0) {
+      table.add(irk.key, IrkTable::SOURCE_LOCAL);
+      result.added++;
+    } else {
+      table.add_source(slot, IrkTable::SOURCE_LOCAL);
+    }
+  }
+  return result;
+}
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#ifdef IRK_RESOLVER_METRICS
+#include "metrics.h"
+#endif
+
+#if defined(USE_ESP_IDF)
+#define MBEDTLS_AES_ALT 1
+#include <aes_alt.h>
+#elif defined(USE_ARDUINO)
+#include "mbedtls/aes.h"
+#else
+// Host builds (Linux tools and daemons) pick AES-NI, ARMv8 or portable AES at startup
+#define IRK_RESOLVER_HOST_AES
+#include "aes_host.h"
+#endif
+
+namespace esphome {
+namespace irk_resolver {
+
+// An expanded AES-128 key schedule
+#ifdef IRK_RESOLVER_HOST_AES
+using AesContext = HostAesKey;
+#else
+using AesContext = mbedtls_aes_context;
+#endif
+
+int bt_encrypt_be(const uint8_t *key, const uint8_t *plaintext, uint8_t *enc_data);
+// Same as above, but encrypts with an already expanded key schedule
+int bt_encrypt_be(AesContext *ctx, const uint8_t *plaintext, uint8_t *enc_data);
+
+// rpa is the address least significant byte first: hash in rpa[0..2], prand in rpa[3..5]
+inline void ble_ll_rpa_plain_text(const uint8_t *rpa, uint8_t *plain_text) {
+  memset(plain_text, 0, 16);
+  plain_text[15] = rpa[3];
+  plain_text[14] = rpa[4];
+  plain_text[13] = rpa[5];
+}
+
+inline bool ble_ll_rpa_hash_matches(const uint8_t *rpa, const uint8_t *cipher_text) {
+  return cipher_text[15] == rpa[0] && cipher_text[14] == rpa[1] && cipher_text[13] == rpa[2];
+}
+
+bool ble_ll_resolv_rpa(const uint8_t *rpa, const uint8_t *irk);
+bool ble_ll_resolv_rpa(const uint8_t *rpa, AesContext *ctx);
+
+// Unpacks a 48-bit address into the byte order ble_ll_resolv_rpa expects
+inline void rpa_from_uint64(uint64_t addr, uint8_t *rpa) {
+  for (int i = 0; i < 6; i++) {
+    rpa[i] = (addr >> (8 * i)) & 0xff;
+  }
+}
+
+inline uint64_t rpa_to_uint64(const uint8_t *rpa) {
+  uint64_t addr = 0;
+  for (int i = 5; i >= 0; i--) {
+    addr = (addr << 8) | rpa[i];
+  }
+  return addr;
+}
+
+// Resolvable private addresses have 0b01 in the two most significant bits
+inline bool is_rpa(uint64_t addr) { return (addr >> 46) == 0x1; }
+
+/*
+ * Bitsliced AES-128 that tests one RPA against up to 32 IRKs at once. Each
+ * 32-bit word holds one bit of the AES state for all 32 IRKs of a batch (lane
+ * j is IRK j), so one pass of the round function is 32 block encryptions.
+ * It is table-free: SubBytes is the Boyar-Peralta S-box circuit. Every lane
+ * shares the same plain text, and only the three S-boxes feeding the RPA hash
+ * bytes run in the last round.
+ *
+ * Build with -DIRK_RESOLVER_BITSLICED to use it instead of the mbedtls path.
+ */
+struct BitslicedIrkBatch {
+  // rk[round][byte][bit], bit 0 being the least significant
+  uint32_t rk[11][16][8];
+  // lanes holding an IRK
+  uint32_t lanes;
+};
+
+static const size_t BITSLICED_LANES = 32;
+
+// Writes irk into the round 0 key of one lane; call bitsliced_expand_keys once all lanes are set
+void bitsliced_set_irk(BitslicedIrkBatch &batch, size_t lane, const uint8_t *irk);
+// Runs the AES-128 key expansion for all lanes at once
+void bitsliced_expand_keys(BitslicedIrkBatch &batch);
+// Returns the index of the first IRK in table that rpa resolves to, or -1
+int resolve_rpa_batch(const uint8_t *rpa, const BitslicedIrkBatch *table, size_t num_batches);
+
+/*
+ * Fixed-size open-addressing map from a 48-bit address to the index of the IRK
+ * it resolved to, or NO_MATCH. Each entry packs the address in the low 48 bits
+ * and index + 2 in the high 16 bits, so an all-zero entry is empty. Nothing is
+ * ever allocated: when a probe run is full, the entry in the home slot is
+ * overwritten.
+ */
+class RpaCache {
+ public:
+  static const size_t SIZE = 256;  // must be a power of two
+  static const size_t MAX_PROBE = 8;
+  static const int NO_MATCH = -1;
+  static const int MISS = -2;
+
+  RpaCache() { this->flush(); }
+
+  void flush() { memset(this->entries_, 0, sizeof(this->entries_)); }
+
+  // Returns the cached index, NO_MATCH, or MISS when the address isn't cached
+  int lookup(uint64_t addr);
+  void insert(uint64_t addr, int index);
+
+  // Drops addr from the cache; entries further along its probe run may go with it
+  void erase(uint64_t addr);
+  // Turns every entry cached as index into NO_MATCH
+  void forget(int index);
+  // Re-resolves every NO_MATCH entry with resolve(addr), which returns an index or NO_MATCH
+  template<typename F> void rematch(F &&resolve) {
+    for (auto &e : this->entries_) {
+      if (e != 0 && (e >> 48) == NO_MATCH + 2) {
+        int index = resolve(e & ADDR_MASK);
+        if (index != NO_MATCH) {
+          e = (e & ADDR_MASK) | ((uint64_t) (index + 2) << 48);
+        }
+      }
+    }
+  }
+
+  uint32_t hits() const { return this->hits_; }
+  uint32_t misses() const { return this->misses_; }
+
+ protected:
+  static const uint64_t ADDR_MASK = 0xffffffffffffULL;
+
+  static size_t home_slot(uint64_t addr) {
+    return (size_t) ((addr * 0x9E3779B97F4A7C15ULL) >> 56) & (SIZE - 1);
+  }
+
+  uint64_t entries_[SIZE];
+  uint32_t hits_{0};
+  uint32_t misses_{0};
+};
+
+struct alignas(16) Irk {
+  uint8_t key[16];
+};
+
+/*
+ * One generation of the IRK set: the keys in a single contiguous, 16-byte
+ * aligned array, plus one expanded AES key schedule per key so that resolving
+ * an advertisement only costs block encryptions and never a key expansion.
+ * With IRK_RESOLVER_BITSLICED the schedules are kept as bitsliced batches and
+ * resolved with resolve_rpa_batch instead.
+ *
+ * A slot's index is the identity reported for its IRK. Removing an IRK leaves
+ * an empty slot behind so that no other identity moves. Only slots added,
+ * removed or copied over since the last expand() are expanded again.
+ *
+ * Each slot also records which sources list its IRK, the loaded set or this
+ * node's own enrollments, so that one source dropping an IRK doesn't unload it
+ * while the other still lists it.
+ *
+ * Storage only ever grows, so rebuilding a table no larger than any previous
+ * one allocates nothing.
+ */
+class IrkTable {
+ public:
+  // Where an IRK came from: the loaded set (irk_prefilter and its deltas) or this node's enrollment store
+  static const uint8_t SOURCE_LOADED = 4;
+  static const uint8_t SOURCE_LOCAL = 8;
+
+  ~IrkTable() { this->release_(); }
+
+  // Empties the table, keeping its storage
+  void clear();
+  // Makes this table a copy of other, marking only the slots that differ for expansion
+  void copy_from(const IrkTable &other);
+  void add(const uint8_t *irk, uint8_t source = SOURCE_LOADED);
+  // Appends an uninitialized slot and returns its key bytes, for decoding in place
+  uint8_t *append(uint8_t source = SOURCE_LOADED);
+  // Drops the most recently appended IRK
+  void pop();
+  // Empties slot i, leaving every other slot where it is
+  void remove(size_t i);
+  // Marks slot i's IRK as also listed by source
+  void add_source(size_t i, uint8_t source) { this->flags_[i] |= source; }
+  // Drops source from slot i and empties the slot once no source lists it; true if it was emptied
+  bool remove_source(size_t i, uint8_t source);
+  // Returns the slot holding irk, or -1
+  int find(const uint8_t *irk) const;
+  // Expands the key schedules; must be called before the table is resolved against
+  bool expand();
+  // Returns the index of the IRK that rpa resolves to, or -1; adds the block encryptions it took to aes_blocks
+  int resolve(const uint8_t *rpa, uint32_t *aes_blocks = nullptr) const;
+
+  // Number of slots, including removed ones
+  size_t size() const { return this->count_; }
+  // Number of slots holding an IRK
+  size_t live_count() const { return this->live_; }
+  bool is_live(size_t i) const { return this->flags_[i] & SLOT_LIVE; }
+  uint8_t sources(size_t i) const { return this->flags_[i] & SOURCE_MASK; }
+  const Irk *irks() const { return this->keys_.get(); }
+
+ protected:
+  static const uint8_t SLOT_LIVE = 1;
+  static const uint8_t SLOT_DIRTY = 2;
+  static const uint8_t SOURCE_MASK = SOURCE_LOADED | SOURCE_LOCAL;
+
+  void grow_(size_t capacity);
+  void release_();
+
+  std::unique_ptr<Irk[]> keys_;
+  std::unique_ptr<uint8_t[]> flags_;
+  size_t count_{0};
+  size_t live_{0};
+  size_t capacity_{0};
+
+#ifdef IRK_RESOLVER_BITSLICED
+  size_t num_batches_() const { return (this->count_ + BITSLICED_LANES - 1) / BITSLICED_LANES; }
+
+  std::unique_ptr<BitslicedIrkBatch[]> batches_;
+#else
+  struct IrkSchedule {
+    AesContext ctx;
+    bool valid;
+  };
+
+  // Never moved once allocated; some mbedtls versions point into the context itself
+  std::unique_ptr<IrkSchedule[]> schedules_;
+#endif
+};
+
+/*
+ * IRKs compiled into flash from the component's irks: option, resolved from the
+ * first advert after boot. With IRK_RESOLVER_BITSLICED their bitsliced round
+ * keys are computed at build time, so they cost no heap and no key expansion.
+ * Otherwise batches is nullptr and the keys are expanded once, when they are
+ * set, into the same per-IRK schedules as loaded IRKs, so a household of a few
+ * phones isn't made to pay a 32-lane bitsliced pass on every cache miss.
+ */
+struct StaticIrkTable {
+  const Irk *keys;
+  const BitslicedIrkBatch *batches;
+  size_t count;
+};
+
+struct IdentityState {
+  uint32_t first_seen_ms;
+  uint32_t last_seen_ms;
+  // When the current RPA was first seen
+  uint32_t rotated_ms;
+  // Number of times a new RPA replaced the previous one
+  uint32_t rotations;
+  // How long the previous RPA was in use, 0 until the first rotation
+  uint32_t rotation_interval_ms;
+};
+
+/*
+ * The RPA each identity is currently advertising with, plus when it was seen
+ * and how often it has rotated. A phone keeps its RPA for several minutes, so
+ * nearly every resolved advert is found here by a linear scan over one 48-bit
+ * address per identity, before any hashing or AES. A new RPA evicts the
+ * identity's previous one.
+ */
+class IdentityTable {
+ public:
+  // Returns the identity currently advertising as addr, or -1
+  int lookup(uint64_t addr, uint32_t now_ms);
+  // Records that identity advertised as addr
+  void seen(size_t identity, uint64_t addr, uint32_t now_ms);
+  // Forgets everything about identity
+  void reset(size_t identity);
+  // Keeps the state of identities below count
+  void resize(size_t count);
+
+  size_t size() const { return this->count_; }
+  // Current RPA of identity, 0 before it has been seen
+  uint64_t address(size_t identity) const { return this->addresses_[identity]; }
+  const IdentityState &state(size_t identity) const { return this->states_[identity]; }
+  // Mean of every identity's last rotation interval, 0 when none has rotated yet
+  uint32_t mean_rotation_interval_ms() const;
+
+ protected:
+  // Kept apart from the states so the scan only touches addresses
+  std::unique_ptr<uint64_t[]> addresses_;
+  std::unique_ptr<IdentityState[]> states_;
+  size_t count_{0};
+  size_t capacity_{0};
+};
+
+/*
+ * Resolves RPAs against the published IRK table. Identities' current RPAs are
+ * checked first, then an address cache of RPAs that matched no IRK. Updates
+ * are built in a separate staging table and published with an atomic pointer
+ * swap, so a reader never sees a half-built table:
+ *
+ *   auto &table = resolver.begin_update();  // or begin_delta()
+ *   table.add(irk);  // for each IRK
+ *   resolver.publish();
+ *
+ * begin_update() starts from an empty table, begin_delta() from a copy of the
+ * published one. The staging table is the one published before the last swap,
+ * so resolve() calls must not outlive the update after the one they started
+ * under.
+ *
+ * Publishing keeps the address cache and identity table when only a few slots
+ * changed: a slot whose IRK went away loses its identity state and cached
+ * entries, and NO_MATCH entries are checked against each newly added IRK.
+ * Larger changes flush both.
+ *
+ * Static IRKs, if any, come first as identities 0 to static_count() - 1, and
+ * slot i of the published table is identity static_count() + i. A published
+ * IRK that is also static is dropped from the table, leaving its slot empty.
+ */
+class IrkResolver {
+ public:
+  // Slots changed in one publish() beyond which the cache is flushed instead of patched
+  static const size_t MAX_CACHE_PATCH = 8;
+
+  IrkResolver() { this->published_.store(&this->tables_[0]); }
+
+  IrkTable &begin_update();
+  IrkTable &begin_delta();
+  bool publish();
+
+  // Resolves irks ahead of the published table; must be called before anything is resolved or published
+  void set_static_irks(const StaticIrkTable &irks);
+  size_t static_count() const { return this->static_.count; }
+
+  // Returns the index of the IRK that rpa resolves to, or -1; now_ms timestamps the identity's sighting
+  int resolve(const uint8_t *rpa, uint32_t now_ms);
+
+  const IrkTable &table() const { return *this->published_.load(std::memory_order_acquire); }
+  // The IRK identity resolves to, or nullptr for a removed slot; for the thread that publishes
+  const uint8_t *irk(size_t identity) const;
+  // Number of static IRKs plus IRKs in the published table
+  size_t size() const { return this->static_.count + this->table().live_count(); }
+  const IdentityTable &identities() const { return this->identities_; }
+  // Lookups answered by the identity table or the address cache, and lookups that needed AES
+  uint32_t cache_hits() const { return this->identity_hits_ + this->cache_.hits(); }
+  uint32_t cache_misses() const { return this->cache_.misses(); }
+
+  // Version of the IRK set as numbered by its sender, 0 when unknown
+  uint32_t generation() const { return this->generation_; }
+  void set_generation(uint32_t generation) { this->generation_ = generation; }
+
+#ifdef IRK_RESOLVER_METRICS
+  ResolverMetrics &metrics() { return this->metrics_; }
+  const ResolverMetrics &metrics() const { return this->metrics_; }
+#endif
+
+ protected:
+  int resolve_(const uint8_t *rpa, uint32_t now_ms);
+  IrkTable *staging_();
+  void patch_cache_(const IrkTable &before, const IrkTable &after);
+
+  StaticIrkTable static_{nullptr, nullptr, 0};
+#ifndef IRK_RESOLVER_BITSLICED
+  // static_'s keys, expanded for the per-IRK path
+  IrkTable static_table_;
+#endif
+  IrkTable tables_[2];
+  std::atomic<IrkTable *> published_;
+  IdentityTable identities_;
+  uint32_t identity_hits_{0};
+  RpaCache cache_;
+  uint32_t generation_{0};
+#ifdef IRK_RESOLVER_METRICS
+  ResolverMetrics metrics_;
+#endif
+};
+
+struct IrkListParseResult {
+  size_t loaded;
+  size_t rejected;
+  // From an "@<generation>" entry, 0 when there is none
+  uint32_t generation;
+};
+
+/*
+ * Parses a colon-separated list of IRKs straight into table, in one pass and
+ * without allocating. Each entry is either 24 characters of padded base64
+ * (22 unpadded) or 32 hex digits; anything else is rejected and skipped.
+ * Whitespace around entries and empty entries are ignored. An "@<generation>"
+ * entry numbers the list for later deltas.
+ */
+IrkListParseResult parse_irk_list(std::string_view irks, IrkTable &table);
+
+struct IrkDeltaResult {
+  size_t added;
+  size_t removed;
+  size_t rejected;
+  // The delta was for a different generation and nothing was applied
+  bool stale;
+};
+
+/*
+ * Applies a delta to the published IRK set, in the same colon-separated form
+ * as parse_irk_list: "+<irk>" adds an IRK in a new slot, "-<irk>" empties the
+ * slot holding it unless the node's own enrollments list it too, and a leading "@<generation>" entry makes the delta apply
+ * only on top of generation - 1, after which the set is at generation. A
+ * stale delta changes nothing; the sender should then send the full list.
+ */
+IrkDeltaResult apply_irk_delta(std::string_view delta, IrkResolver &resolver);
+
+/*
+ * Moves table's SOURCE_LOCAL IRKs from one list to another, both in
+ * parse_irk_list's form: an IRK only in before loses its slot unless the
+ * loaded set lists it too, and an IRK in after that table doesn't hold yet gets
+ * a new one. Generation entries are ignored. Keeps this node's own enrollments
+ * on top of the loaded set. Each list is decoded once, into a sorted array.
+ */
+IrkDeltaResult merge_irk_list(std::string_view before, std::string_view after, IrkTable &table);
+
+}  // namespace irk_resolver
+}  // namespace esphome
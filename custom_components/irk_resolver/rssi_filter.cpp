@@ -0,0 +1,45 @@
+#include "rssi_filter.h"
+
+#include <cmath>
+
+namespace esphome {
+namespace irk_resolver {
+
+float RssiFilter::update(int identity, int rssi, uint32_t now_ms) {
+  if ((size_t) identity >= this->states_.size()) {
+    this->states_.resize(identity + 1, State{0, 0, 0});
+  }
+  State &s = this->states_[identity];
+  float sample = rssi + this->offset_;
+  // unsigned, so the gap survives a millis() wrap
+  uint32_t dt_ms = now_ms - s.updated_ms;
+  s.updated_ms = now_ms;
+
+  if (s.variance == 0) {
+    s.value = sample;
+    s.variance = this->measurement_noise_;
+    return s.value;
+  }
+
+  if (this->mode_ == RSSI_FILTER_EWMA) {
+    // the previous estimate keeps half its weight after one half-life
+    float keep = powf(0.5f, (float) dt_ms / this->half_life_ms_);
+    s.value = keep * s.value + (1 - keep) * sample;
+  } else {
+    float predicted = s.variance + this->process_noise_ * dt_ms / 1000.0f;
+    float gain = predicted / (predicted + this->measurement_noise_);
+    s.value += gain * (sample - s.value);
+    s.variance = (1 - gain) * predicted;
+  }
+  return s.value;
+}
+
+float RssiFilter::value(int identity) const {
+  if (identity < 0 || (size_t) identity >= this->states_.size() || this->states_[identity].variance == 0) {
+    return NAN;
+  }
+  return this->states_[identity].value;
+}
+
+}  // namespace irk_resolver
+}  // namespace esphome
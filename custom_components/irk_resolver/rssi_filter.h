@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace irk_resolver {
+
+enum RssiFilterMode : uint8_t {
+  // Exponentially weighted average whose weights halve every half-life, like irk_tracker.py's ping_halflife_seconds
+  RSSI_FILTER_EWMA,
+  // 1-D Kalman filter over a random walk
+  RSSI_FILTER_KALMAN,
+};
+
+/*
+ * Smooths each identity's RSSI on the proxy, so that downstream logic can use
+ * a few filtered samples instead of every advert. State is a fixed 12 bytes
+ * per identity. Updates are weighted by the time since the identity's last
+ * advert, so a burst of adverts counts no more than its duration.
+ *
+ * The offset is added to every sample first; it is this proxy's entry of
+ * irk_tracker.py's rssi_adjustments.
+ */
+class RssiFilter {
+ public:
+  RssiFilter(RssiFilterMode mode, uint32_t half_life_ms, float process_noise, float measurement_noise, float offset)
+      : mode_(mode),
+        half_life_ms_(half_life_ms),
+        process_noise_(process_noise),
+        measurement_noise_(measurement_noise),
+        offset_(offset) {}
+
+  // Adds one sample and returns the filtered RSSI
+  float update(int identity, int rssi, uint32_t now_ms);
+  // Filtered RSSI of identity, or NAN before its first sample
+  float value(int identity) const;
+
+  RssiFilterMode mode() const { return this->mode_; }
+  uint32_t half_life_ms() const { return this->half_life_ms_; }
+  float offset() const { return this->offset_; }
+
+ protected:
+  struct State {
+    float value;
+    // Kalman error variance; 0 marks an identity without samples
+    float variance;
+    uint32_t updated_ms;
+  };
+
+  RssiFilterMode mode_;
+  uint32_t half_life_ms_;
+  // dB^2 the RSSI may drift per second, and dB^2 of noise on each sample (Kalman only)
+  float process_noise_;
+  float measurement_noise_;
+  float offset_;
+  // Indexed by identity
+  std::vector<State> states_;
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,28 @@
+#include "scan_controller.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace irk_resolver {
+
+float ScanController::update(uint32_t now_ms, uint32_t loop_lag_ms) {
+  // Ages are unsigned differences, so they survive a millis() wrap
+  if (loop_lag_ms > this->max_loop_lag_ms_) {
+    this->duty_ /= 2;
+    this->reason_ = SCAN_DUTY_CONGESTED;
+  } else if (this->has_first_seen_ && now_ms - this->first_seen_ms_ < this->hold_ms_) {
+    this->duty_ = this->max_duty_;
+    this->reason_ = SCAN_DUTY_ARRIVAL;
+  } else if (this->has_resolved_ && now_ms - this->resolved_ms_ < this->nearby_ms_) {
+    this->duty_ += this->step_;
+    this->reason_ = SCAN_DUTY_NEARBY;
+  } else {
+    this->duty_ -= this->step_;
+    this->reason_ = SCAN_DUTY_QUIET;
+  }
+  this->duty_ = std::max(this->min_duty_, std::min(this->max_duty_, this->duty_));
+  return this->duty_;
+}
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace irk_resolver {
+
+// Why ScanController picked its last duty cycle
+enum ScanDutyReason : uint8_t {
+  // An identity was first seen within the hold time; scan as much as allowed to locate it quickly
+  SCAN_DUTY_ARRIVAL,
+  // Some identity resolved recently; step up towards the maximum
+  SCAN_DUTY_NEARBY,
+  // Nothing resolved recently; step down towards the minimum
+  SCAN_DUTY_QUIET,
+  // The main loop stalled, so Wi-Fi and the API are short of time; halve the duty
+  SCAN_DUTY_CONGESTED,
+};
+
+/*
+ * Picks the fraction of time the BLE scanner listens, between a minimum and a
+ * maximum. An arrival jumps straight to the maximum, so the new identity's
+ * room is found quickly. Identities that keep resolving step it up, and a
+ * quiet air steps it back down. Loop stalls take priority over all of these
+ * and halve it, since a stalled main loop means Wi-Fi and the API are losing
+ * out on radio or CPU time.
+ */
+class ScanController {
+ public:
+  ScanController(float min_duty, float max_duty, float step, uint32_t hold_ms, uint32_t nearby_ms,
+                 uint32_t max_loop_lag_ms)
+      : min_duty_(min_duty),
+        max_duty_(max_duty),
+        step_(step),
+        hold_ms_(hold_ms),
+        nearby_ms_(nearby_ms),
+        max_loop_lag_ms_(max_loop_lag_ms),
+        duty_(max_duty) {}
+
+  // Notes a resolved advert; the first one after a quiet spell counts as an arrival
+  void resolved(uint32_t now_ms) {
+    if (!this->has_resolved_ || now_ms - this->resolved_ms_ >= this->nearby_ms_) {
+      this->first_seen(now_ms);
+    }
+    this->resolved_ms_ = now_ms;
+    this->has_resolved_ = true;
+  }
+  // Notes an identity seen for the first time in a while, as reported by the aggregator
+  void first_seen(uint32_t now_ms) {
+    this->first_seen_ms_ = now_ms;
+    this->has_first_seen_ = true;
+  }
+
+  // Returns the duty cycle for the next period, given the longest gap between main loop iterations in this one
+  float update(uint32_t now_ms, uint32_t loop_lag_ms);
+
+  float duty() const { return this->duty_; }
+  ScanDutyReason reason() const { return this->reason_; }
+  float min_duty() const { return this->min_duty_; }
+  float max_duty() const { return this->max_duty_; }
+
+ protected:
+  float min_duty_;
+  float max_duty_;
+  float step_;
+  uint32_t hold_ms_;
+  uint32_t nearby_ms_;
+  uint32_t max_loop_lag_ms_;
+
+  // Starts at the maximum so that identities already present are found right after boot
+  float duty_;
+  ScanDutyReason reason_{SCAN_DUTY_ARRIVAL};
+  uint32_t resolved_ms_{0};
+  uint32_t first_seen_ms_{0};
+  bool has_resolved_{false};
+  bool has_first_seen_{false};
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace irk_resolver {
+
+/*
+ * Lock-free ring for exactly one producer and one consumer thread. The
+ * capacity is rounded up to a power of two and allocated once; a push into a
+ * full ring fails and is counted as dropped rather than blocking the producer.
+ */
+template<typename T> class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    this->items_.reset(new T[size]);
+    this->mask_ = size - 1;
+  }
+
+  // Producer side
+  bool push(const T &item) {
+    size_t tail = this->tail_.load(std::memory_order_relaxed);
+    if (tail - this->head_.load(std::memory_order_acquire) > this->mask_) {
+      this->dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    this->items_[tail & this->mask_] = item;
+    this->tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T *item) {
+    size_t head = this->head_.load(std::memory_order_relaxed);
+    if (head == this->tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = this->items_[head & this->mask_];
+    this->head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return this->head_.load(std::memory_order_acquire) == this->tail_.load(std::memory_order_acquire);
+  }
+  // Items queued; exact only on the producer or consumer thread
+  size_t size() const {
+    return this->tail_.load(std::memory_order_acquire) - this->head_.load(std::memory_order_acquire);
+  }
+  size_t capacity() const { return this->mask_ + 1; }
+  uint32_t dropped() const { return this->dropped_.load(std::memory_order_relaxed); }
+
+ protected:
+  std::unique_ptr<T[]> items_;
+  size_t mask_;
+  // Free-running indices, masked on access; head and tail are written by different cores, so keep them apart
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  std::atomic<uint32_t> dropped_{0};
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
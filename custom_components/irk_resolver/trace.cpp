@@ -0,0 +1,51 @@
+#include "trace.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace irk_resolver {
+
+TraceRecorder::TraceRecorder(size_t capacity) : records_(new TraceRecord[capacity]), capacity_(capacity) {}
+
+void TraceRecorder::record(uint32_t timestamp_ms, uint64_t address, uint8_t address_type, int8_t rssi,
+                           uint16_t source) {
+  if (this->capacity_ == 0) {
+    return;
+  }
+  TraceRecord &r = this->records_[(this->head_ + this->count_) % this->capacity_];
+  if (this->count_ == this->capacity_) {
+    this->head_ = (this->head_ + 1) % this->capacity_;
+    this->dropped_++;
+  } else {
+    this->count_++;
+  }
+
+  r.timestamp_ms = timestamp_ms;
+  r.source = source;
+  r.address_type = address_type;
+  r.rssi = rssi;
+  for (int i = 0; i < 6; i++) {
+    r.address[i] = (address >> (8 * i)) & 0xff;
+  }
+  memset(r.reserved, 0, sizeof(r.reserved));
+}
+
+void TraceRecorder::clear() {
+  this->head_ = 0;
+  this->count_ = 0;
+  this->dropped_ = 0;
+}
+
+TraceHeader TraceRecorder::header() const {
+  TraceHeader h{};
+  h.magic = TRACE_MAGIC;
+  h.version = TRACE_VERSION;
+  h.record_size = sizeof(TraceRecord);
+  h.record_count = this->count_;
+  return h;
+}
+
+const TraceRecord &TraceRecorder::at(size_t i) const { return this->records_[(this->head_ + i) % this->capacity_]; }
+
+}  // namespace irk_resolver
+}  // namespace esphome
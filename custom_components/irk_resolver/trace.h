@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace irk_resolver {
+
+/*
+ * Binary advertisement trace: one TraceHeader followed by fixed-width
+ * TraceRecords, all little-endian. Both structs are naturally aligned, so a
+ * file can be mmapped and indexed directly.
+ */
+static const uint32_t TRACE_MAGIC = 0x544b5249;  // "IRKT"
+static const uint16_t TRACE_VERSION = 1;
+
+struct TraceHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  // 0 when unknown; the record count then follows from the file size
+  uint32_t record_count;
+  uint32_t reserved;
+};
+
+struct TraceRecord {
+  // milliseconds, from the recording device's clock
+  uint32_t timestamp_ms;
+  uint16_t source;
+  uint8_t address_type;
+  int8_t rssi;
+  // least significant byte first, as ble_ll_resolv_rpa takes it
+  uint8_t address[6];
+  uint8_t reserved[2];
+};
+
+static_assert(sizeof(TraceHeader) == 16, "TraceHeader must stay 16 bytes");
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+/*
+ * Fixed-capacity RAM ring of trace records. The buffer is allocated once; when
+ * full, the oldest record is overwritten and counted as dropped.
+ */
+class TraceRecorder {
+ public:
+  explicit TraceRecorder(size_t capacity);
+
+  void record(uint32_t timestamp_ms, uint64_t address, uint8_t address_type, int8_t rssi, uint16_t source);
+  void clear();
+
+  // Header describing the records currently held
+  TraceHeader header() const;
+  // The i-th oldest record held
+  const TraceRecord &at(size_t i) const;
+
+  size_t size() const { return this->count_; }
+  size_t capacity() const { return this->capacity_; }
+  uint32_t dropped() const { return this->dropped_; }
+
+ protected:
+  std::unique_ptr<TraceRecord[]> records_;
+  size_t capacity_;
+  size_t head_{0};
+  size_t count_{0};
+  uint32_t dropped_{0};
+};
+
+}  // namespace irk_resolver
+}  // namespace esphome
@@ -1,7 +1,7 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import binary_sensor
-from esphome.const import CONF_ID
+from esphome.const import CONF_ID, CONF_MODE
 
 CODEOWNERS = ["@dgrnbrg"]
 
@@ -10,26 +10,82 @@ PresenceComboComponent = presence_combo_ns.class_("PresenceComboComponent",
         binary_sensor.BinarySensor,
         cg.Component,
 )
+PresenceComboMode = presence_combo_ns.enum("PresenceComboMode")
+PRESENCE_COMBO_MODES = {
+    "ANY": PresenceComboMode.PRESENCE_COMBO_ANY,
+    "ALL": PresenceComboMode.PRESENCE_COMBO_ALL,
+    "AT_LEAST": PresenceComboMode.PRESENCE_COMBO_AT_LEAST,
+    "WEIGHTED": PresenceComboMode.PRESENCE_COMBO_WEIGHTED,
+}
 
 CONF_IDS = "ids"
+CONF_COUNT = "count"
+CONF_WEIGHT = "weight"
+CONF_ON_THRESHOLD = "on_threshold"
+CONF_OFF_THRESHOLD = "off_threshold"
 
-CONFIG_SCHEMA = (
+CHILD_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.use_id(binary_sensor.BinarySensor),
+        cv.Optional(CONF_WEIGHT, default=1.0): cv.positive_float,
+    }
+)
+
+
+def child_sensor(value):
+    # A bare id, or an id with a weight
+    if isinstance(value, dict):
+        return CHILD_SCHEMA(value)
+    return CHILD_SCHEMA({CONF_ID: value})
+
+
+def validate_mode(config):
+    mode = config[CONF_MODE]
+    if mode == "AT_LEAST":
+        if CONF_COUNT not in config:
+            raise cv.Invalid("at_least needs a count")
+        if config[CONF_COUNT] > len(config[CONF_IDS]):
+            raise cv.Invalid("count can't be more than the number of ids")
+    elif CONF_COUNT in config:
+        raise cv.Invalid("count only applies to at_least")
+    if mode == "WEIGHTED":
+        if CONF_ON_THRESHOLD not in config:
+            raise cv.Invalid("weighted needs an on_threshold")
+        config.setdefault(CONF_OFF_THRESHOLD, config[CONF_ON_THRESHOLD])
+        if config[CONF_OFF_THRESHOLD] > config[CONF_ON_THRESHOLD]:
+            raise cv.Invalid("off_threshold can't be above on_threshold")
+    elif CONF_ON_THRESHOLD in config or CONF_OFF_THRESHOLD in config:
+        raise cv.Invalid("on_threshold and off_threshold only apply to weighted")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     binary_sensor.BINARY_SENSOR_SCHEMA
     .extend(
         {
             cv.GenerateID(): cv.declare_id(PresenceComboComponent),
             cv.Required(CONF_IDS): cv.All(
-                cv.ensure_list(cv.use_id(binary_sensor.BinarySensor)),
+                cv.ensure_list(child_sensor),
                 cv.Length(min=1),
             ),
+            cv.Optional(CONF_MODE, default="ANY"): cv.enum(PRESENCE_COMBO_MODES, upper=True),
+            cv.Optional(CONF_COUNT): cv.positive_not_null_int,
+            cv.Optional(CONF_ON_THRESHOLD): cv.positive_float,
+            cv.Optional(CONF_OFF_THRESHOLD): cv.positive_float,
         }
     )
-    .extend(cv.COMPONENT_SCHEMA)
+    .extend(cv.COMPONENT_SCHEMA),
+    validate_mode,
 )
 
 async def to_code(config):
     var = await binary_sensor.new_binary_sensor(config)
     await cg.register_component(var, config)
     for x in config[CONF_IDS]:
-        child_var = await cg.get_variable(x)
-        cg.add(var.add_child_sensor(child_var))
+        child_var = await cg.get_variable(x[CONF_ID])
+        cg.add(var.add_child_sensor(child_var, x[CONF_WEIGHT]))
+    cg.add(var.set_mode(config[CONF_MODE]))
+    if CONF_COUNT in config:
+        cg.add(var.set_count(config[CONF_COUNT]))
+    if CONF_ON_THRESHOLD in config:
+        cg.add(var.set_thresholds(config[CONF_ON_THRESHOLD], config[CONF_OFF_THRESHOLD]))
@@ -7,34 +7,82 @@ namespace presence_combo {
     static const char *const TAG = "presence_combo";
 
     void PresenceComboComponent::setup() {
-        this->state_ = false;
-        for (auto& c : children_) {
+        // Count the children that are already on, then follow their changes instead of polling them
+        this->child_states_.resize(this->children_.size());
+        for (size_t i = 0; i < this->children_.size(); i++) {
+            auto *c = this->children_[i];
+            this->child_states_[i] = c->state;
             if (c->state) {
-                this->state_ = true;
+                this->active_++;
+                this->weight_ += this->weights_[i];
             }
+            c->add_on_state_callback([this, i](bool state) { this->on_child_state_(i, state); });
         }
+        this->state_ = this->evaluate_();
         this->publish_initial_state(this->state_);
     }
 
-    void PresenceComboComponent::dump_config() {
-        LOG_BINARY_SENSOR("", "Presence Combo Sensor", this);
-        for (auto& c : children_) {
-            LOG_BINARY_SENSOR("  ", "Sub-sensor", c);
+    void PresenceComboComponent::on_child_state_(size_t i, bool state) {
+        if (this->child_states_[i] == state) {
+            return;
+        }
+        this->child_states_[i] = state;
+        if (state) {
+            this->active_++;
+            this->weight_ += this->weights_[i];
+        } else {
+            this->active_--;
+            // Restart the sum when nothing is on, so rounding can't build up
+            this->weight_ = this->active_ == 0 ? 0 : this->weight_ - this->weights_[i];
+        }
+        bool combined = this->evaluate_();
+        if (combined != this->state_) {
+            this->state_ = combined;
+            this->publish_state(this->state_);
         }
     }
 
-    float PresenceComboComponent::get_setup_priority() const {
-        return setup_priority::DATA;
+    bool PresenceComboComponent::evaluate_() const {
+        switch (this->mode_) {
+            case PRESENCE_COMBO_ALL:
+                return this->active_ == this->children_.size();
+            case PRESENCE_COMBO_AT_LEAST:
+                return this->active_ >= this->count_;
+            case PRESENCE_COMBO_WEIGHTED:
+                // Once on, stay on until the sum drops below the off threshold
+                return this->weight_ >= (this->state_ ? this->off_threshold_ : this->on_threshold_);
+            default:
+                return this->active_ > 0;
+        }
     }
 
-    void PresenceComboComponent::loop() {
-        this->state_ = false;
-        for (auto& c : children_) {
-            if (c->state) {
-                this->state_ = true;
+    void PresenceComboComponent::dump_config() {
+        LOG_BINARY_SENSOR("", "Presence Combo Sensor", this);
+        switch (this->mode_) {
+            case PRESENCE_COMBO_ALL:
+                ESP_LOGCONFIG(TAG, "  Mode: all");
+                break;
+            case PRESENCE_COMBO_AT_LEAST:
+                ESP_LOGCONFIG(TAG, "  Mode: at least %u", (unsigned) this->count_);
+                break;
+            case PRESENCE_COMBO_WEIGHTED:
+                ESP_LOGCONFIG(TAG, "  Mode: weighted, on at %.2f, off below %.2f", this->on_threshold_,
+                              this->off_threshold_);
+                break;
+            default:
+                ESP_LOGCONFIG(TAG, "  Mode: any");
+                break;
+        }
+        for (size_t i = 0; i < this->children_.size(); i++) {
+            LOG_BINARY_SENSOR("  ", "Sub-sensor", this->children_[i]);
+            if (this->mode_ == PRESENCE_COMBO_WEIGHTED) {
+                ESP_LOGCONFIG(TAG, "    Weight: %.2f", this->weights_[i]);
             }
         }
-        this->publish_state(this->state_);
+    }
+
+    float PresenceComboComponent::get_setup_priority() const {
+        return setup_priority::DATA;
     }
 
 }
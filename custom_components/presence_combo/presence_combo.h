@@ -11,24 +11,56 @@
 namespace esphome {
 namespace presence_combo {
 
+// How the children's states combine
+enum PresenceComboMode : uint8_t {
+  PRESENCE_COMBO_ANY,
+  PRESENCE_COMBO_ALL,
+  // At least count children on
+  PRESENCE_COMBO_AT_LEAST,
+  // The weights of the children that are on add up to on_threshold, and stay at or above off_threshold
+  PRESENCE_COMBO_WEIGHTED,
+};
+
 class PresenceComboComponent : public esphome::Component, public esphome::binary_sensor::BinarySensor
 {
   public:
    PresenceComboComponent() {}
 
     void dump_config() override;
-    void loop() override;
     void setup() override;
   
     float get_setup_priority() const;
   
-    void add_child_sensor(binary_sensor::BinarySensor * child) {
+    void add_child_sensor(binary_sensor::BinarySensor * child, float weight = 1.0f) {
         children_.push_back(child);
+        weights_.push_back(weight);
+    }
+    void set_mode(PresenceComboMode mode) { mode_ = mode; }
+    void set_count(size_t count) { count_ = count; }
+    void set_thresholds(float on_threshold, float off_threshold) {
+        on_threshold_ = on_threshold;
+        off_threshold_ = off_threshold;
     }
   
   protected:
+    // Called by child i's state callback; only a change of the combined state is published
+    void on_child_state_(size_t i, bool state);
+    // The combined state from the running count and sum, without looking at the children
+    bool evaluate_() const;
+
     std::vector<binary_sensor::BinarySensor*> children_;
-    bool state_;
+    std::vector<float> weights_;
+    // Last state seen from each child, so a repeated state doesn't count twice
+    std::vector<bool> child_states_;
+    // Children that are currently on
+    size_t active_{0};
+    // Sum of their weights
+    float weight_{0};
+    PresenceComboMode mode_{PRESENCE_COMBO_ANY};
+    size_t count_{1};
+    float on_threshold_{1};
+    float off_threshold_{1};
+    bool state_{false};
   
 };
 }
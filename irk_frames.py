@@ -0,0 +1,47 @@
+# Decoder for the batched binary frames sent by irk_resolver's batch: transport
+# (see custom_components/irk_resolver/frame.h for the layout)
+import base64
+import struct
+
+FRAME_VERSION = 2
+HEADER = struct.Struct('<BBHII')
+RECORD = struct.Struct('<HIb')
+
+
+class FrameError(ValueError):
+    pass
+
+
+def identity_key(irk):
+    """The key frames identify an IRK by: 32-bit FNV-1a of its 16 bytes, as
+    sensor.irk_prefilter lists them (frame_identity_key() on the proxy)."""
+    h = 2166136261
+    for b in irk:
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return h
+
+
+def decode_frame(frame):
+    """Decodes one frame, given as bytes or base64 text.
+
+    Returns a dict with the header fields and 'records', a list of
+    (timestamp_ms, identity_key, rssi) tuples with timestamps on the proxy's
+    clock. identity_key is identity_key() of the IRK the advert resolved to.
+    """
+    if isinstance(frame, str):
+        frame = base64.b64decode(frame)
+    if len(frame) < HEADER.size:
+        raise FrameError(f'frame too short: {len(frame)} bytes')
+    version, count, source, first_ms, generation = HEADER.unpack_from(frame)
+    if version != FRAME_VERSION:
+        raise FrameError(f'unsupported frame version {version}')
+    if len(frame) != HEADER.size + count * RECORD.size:
+        raise FrameError(f'frame holds {len(frame)} bytes for {count} records')
+
+    records = []
+    ts = first_ms
+    for i in range(count):
+        delta, identity_key, rssi = RECORD.unpack_from(frame, HEADER.size + i * RECORD.size)
+        ts = (ts + delta) & 0xffffffff
+        records.append((ts, identity_key, rssi))
+    return {'source': source, 'generation': generation, 'first_ms': first_ms, 'records': records}
@@ -10,6 +10,7 @@ import os
 from glob import glob
 from collections import defaultdict
 import numpy as np
+from irk_frames import decode_frame, identity_key, FrameError
 
 
 tracker_log_loc = '/config/appdaemon/tracker_logs/'
@@ -54,10 +55,17 @@ class IrkTracker(hass.Hass):
         self.ciphers = {}
         self.people = set(x['person'] for x in self.args['identities'])
         irk_prefilters = [] # will be a list of base64 encoded IRKs
+        self.devices_by_key = {} # frames name devices by identity_key() of their IRK
         for identity, data in self.identities.items():
             byte_form = bytearray.fromhex(data['irk'])
             irk_prefilters.append(base64.b64encode(byte_form).decode("ascii"))
             self.ciphers[identity] = AES.new(byte_form, AES.MODE_ECB)
+            key = identity_key(byte_form)
+            if key in self.devices_by_key:
+                self.log(f"{identity} and {self.devices_by_key[key]} have the same frame identity key, ignoring both in frames")
+                self.devices_by_key[key] = None
+            else:
+                self.devices_by_key[key] = identity
             device_clean_name = identity.replace(" ", "_")
             device_ent = self.get_entity(f'device_tracker.{device_clean_name}_irk')
             if device_ent.exists():
@@ -121,6 +129,7 @@ class IrkTracker(hass.Hass):
             nearest_beacons = pullout_sensor['nearest_beacons']
             self.listen_state(self.pullout_sensor_cb, entity, cfg=pullout_sensor)#, old=from_state, new=to_state, nearest_beacons=nearest_beacons)
         self.listen_event(self.ble_tracker_cb, "esphome.ble_tracking_beacon", addr=lambda addr: self.known_addr_cache.get(addr,None) != 'none')
+        self.listen_event(self.ble_frame_cb, "esphome.ble_tracking_frame")
         self.recording_df = None
         self.listen_event(self.start_recording, "irk_tracker.start_recording")
         self.listen_event(self.stop_recording, "irk_tracker.stop_recording")
@@ -270,9 +279,43 @@ class IrkTracker(hass.Hass):
         if matched_device == 'none':
             return
         #self.log(f"found a match {matched_device}")
-        time = datetime.now()
-        source = data['source']
-        rssi = int(data['rssi'])
+        # aggregated events carry the mean rssi of count adverts, and the proxy's filtered rssi when it has a filter
+        rssi = float(data['rssi'])
+        try:
+            filtered = float(data.get('rssi_filtered', 'nan'))
+        except ValueError:
+            filtered = float('nan')
+        # a proxy without rssi_filter: may still send it, as nan
+        if np.isfinite(filtered):
+            rssi = filtered
+        self.observe(matched_device, data['source'], rssi, int(data.get('count', 1)), datetime.now())
+
+    @ad.app_lock
+    def ble_frame_cb(self, event_name, data, kwargs):
+        try:
+            frame = decode_frame(data['frame'])
+        except (FrameError, ValueError) as e:
+            self.log(f"dropping bad frame from {data.get('source')}: {e}")
+            return
+        records = frame['records']
+        if not records:
+            return
+        # record timestamps are on the proxy's clock, so only their age relative to the last one is used
+        now = datetime.now()
+        last_ms = records[-1][0]
+        seen = set()
+        for ts, key, rssi in records:
+            # the proxy may also resolve IRKs that aren't tracked here, such as ones enrolled on it
+            device = self.devices_by_key.get(key)
+            if device is None:
+                continue
+            age = timedelta(milliseconds=(last_ms - ts) & 0xffffffff)
+            self.observe(device, data['source'], rssi, 1, now - age, resolve=False)
+            seen.add(device)
+        for device in seen:
+            self.tracking_resolve(device)
+
+    def observe(self, matched_device, source, rssi, count, time, resolve=True):
         if self.recording_df is not None:
             self.recording_df['time'].append(time)
             self.recording_df['device'].append(matched_device)
@@ -298,8 +341,9 @@ class IrkTracker(hass.Hass):
                 self.set_person_fused_tracker_state(device_person, 'just_arrived', f'saw {matched_device}')
                 self.log(f"{device_person} just arrived due to first observation from {matched_device}")
                 self.schedule_arrival_after_delay(device_person)
-        obs.append((time, rssi + self.rssi_adjustments.get(source,0)))
-        self.tracking_resolve(matched_device)
+        obs.append((time, rssi + self.rssi_adjustments.get(source,0), count))
+        if resolve:
+            self.tracking_resolve(matched_device)
         if matched_device in self.expiry_timers:
             self.cancel_timer(self.expiry_timers[matched_device])
         self.expiry_timers[matched_device] = self.run_in(self.device_expiry, delay=self.tracking_window.total_seconds(), expiring_device = matched_device)
@@ -324,7 +368,7 @@ class IrkTracker(hass.Hass):
                 continue
             room = source#self.room_aliases[source]
             room_votes[room].extend(obs)
-            total_votes += len(obs)
+            total_votes += sum(n for _, _, n in obs)
         weighted_votes = []
         if total_votes < 3:
             # not enough info
@@ -335,12 +379,12 @@ class IrkTracker(hass.Hass):
                 if len(obs) == 0:
                     continue # nothing to do
                 count = numerator = denominator = 0
-                for time, rssi in obs:
+                for time, rssi, n in obs:
                     #weight = 1.0
-                    weight = 0.5**((now-time).total_seconds()/self.ping_halflife_seconds)
+                    weight = n * 0.5**((now-time).total_seconds()/self.ping_halflife_seconds)
                     numerator += -rssi * weight
                     denominator += weight
-                    count += 1
+                    count += n
                 orig_source = room
                 # at this point, resolve to a room
                 weighted_votes.append((numerator / denominator, count, orig_source))
@@ -0,0 +1,349 @@
+// Host-side microbenchmark for RPA resolution.
+//
+// Builds the irk_resolver component's resolver core on the host AES backends:
+//
+//   g++ -O2 -std=gnu++17 -I custom_components/irk_resolver -o irk_bench
+//       tools/irk_bench.cpp custom_components/irk_resolver/rpa_resolver.cpp custom_components/irk_resolver/aes_host.cpp
+//
+// Add -DIRK_RESOLVER_BITSLICED to benchmark IrkResolver on the bitsliced kernel,
+// and run with IRK_RESOLVER_AES=portable to time the per-IRK path without AES-NI
+// or the ARMv8 crypto extensions.
+// Before timing anything it checks that every resolve path returns exactly what
+// the original per-advert ble_ll_resolv_rpa(rpa, irk) loop does, and exits
+// non-zero if any of them disagree.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rpa_resolver.h"
+
+using namespace esphome::irk_resolver;
+
+static std::mt19937_64 rng(0x1d3a5);
+
+static std::vector<Irk> random_irks(size_t n) {
+  std::vector<Irk> irks(n);
+  for (auto &irk : irks) {
+    for (auto &b : irk.key) {
+      b = rng();
+    }
+  }
+  return irks;
+}
+
+// Returns a fresh RPA; when irk is given, one that resolves to it
+static uint64_t make_rpa(const Irk *irk) {
+  uint8_t rpa[6];
+  for (auto &b : rpa) {
+    b = rng();
+  }
+  rpa[5] = (rpa[5] & 0x3f) | 0x40;
+  if (irk != nullptr) {
+    uint8_t plain_text[16], cipher_text[16];
+    ble_ll_rpa_plain_text(rpa, plain_text);
+    bt_encrypt_be(irk->key, plain_text, cipher_text);
+    rpa[0] = cipher_text[15];
+    rpa[1] = cipher_text[14];
+    rpa[2] = cipher_text[13];
+  }
+  return rpa_to_uint64(rpa);
+}
+
+// A public address, which the component rejects before any lookup
+static uint64_t make_non_rpa() { return rng() & 0x3fffffffffffULL; }
+
+// The resolve path as it was before any of the resolver work: one key expansion per IRK per advert
+static int reference_resolve(const uint8_t *rpa, const std::vector<Irk> &irks) {
+  for (size_t i = 0; i < irks.size(); i++) {
+    if (ble_ll_resolv_rpa(rpa, irks[i].key)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void load(IrkResolver &resolver, const std::vector<Irk> &irks) {
+  auto &table = resolver.begin_update();
+  for (auto &irk : irks) {
+    table.add(irk.key);
+  }
+  resolver.publish();
+}
+
+static std::vector<BitslicedIrkBatch> make_batches(const std::vector<Irk> &irks) {
+  std::vector<BitslicedIrkBatch> batches((irks.size() + BITSLICED_LANES - 1) / BITSLICED_LANES);
+  memset(batches.data(), 0, batches.size() * sizeof(BitslicedIrkBatch));
+  for (size_t i = 0; i < irks.size(); i++) {
+    bitsliced_set_irk(batches[i / BITSLICED_LANES], i % BITSLICED_LANES, irks[i].key);
+  }
+  for (auto &batch : batches) {
+    bitsliced_expand_keys(batch);
+  }
+  return batches;
+}
+
+static bool verify(size_t n) {
+  auto irks = random_irks(n);
+  IrkResolver resolver;
+  load(resolver, irks);
+  auto batches = make_batches(irks);
+
+  for (int i = 0; i < 2000; i++) {
+    // a third resolve to a known IRK, the rest to none
+    size_t target = rng() % (3 * n);
+    uint8_t rpa[6];
+    rpa_from_uint64(make_rpa(target < n ? &irks[target] : nullptr), rpa);
+
+    int expected = reference_resolve(rpa, irks);
+    int uncached = resolver.resolve(rpa, i);
+    int cached = resolver.resolve(rpa, i);
+    int batched = resolve_rpa_batch(rpa, batches.data(), batches.size());
+    if (uncached != expected || cached != expected || batched != expected) {
+      printf("MISMATCH with %zu IRKs: reference %d, resolver %d, cached %d, batch %d\n", n, expected, uncached, cached,
+             batched);
+      return false;
+    }
+  }
+  return true;
+}
+
+// The list parser must accept hex as well as base64, and skip malformed entries without losing the rest
+static bool verify_parser() {
+  auto irks = random_irks(3);
+  std::string list = " ";
+  for (auto &irk : irks) {
+    for (auto b : irk.key) {
+      char hex[3];
+      snprintf(hex, sizeof(hex), "%02X", b);
+      list += hex;
+    }
+    list += " :not-an-irk:AAAAAAAAAAAAAAAAAAAAAB==::";
+  }
+
+  IrkTable table;
+  auto result = parse_irk_list(list, table);
+  bool ok = result.loaded == irks.size() && result.rejected == 2 * irks.size() &&
+            memcmp(table.irks(), irks.data(), irks.size() * sizeof(Irk)) == 0;
+  if (!ok) {
+    printf("MISMATCH in parse_irk_list: loaded %zu, rejected %zu\n", result.loaded, result.rejected);
+  }
+  return ok;
+}
+
+static std::string to_hex(const Irk &irk) {
+  std::string hex;
+  for (auto b : irk.key) {
+    char buf[3];
+    snprintf(buf, sizeof(buf), "%02x", b);
+    hex += buf;
+  }
+  return hex;
+}
+
+// Deltas must leave every cached and uncached answer as if the table had been built from scratch, with removed
+// IRKs leaving their index empty
+static bool verify_delta(size_t n) {
+  auto irks = random_irks(n);
+  IrkResolver resolver;
+  load(resolver, irks);
+  resolver.set_generation(1);
+
+  // warm the cache with addresses of every IRK, and of IRKs that are about to be added
+  auto added = random_irks(2);
+  std::vector<uint64_t> addrs;
+  for (int i = 0; i < 200; i++) {
+    size_t target = rng() % (n + 2);
+    addrs.push_back(make_rpa(target < n ? &irks[target] : &added[target - n]));
+    uint8_t rpa[6];
+    rpa_from_uint64(addrs.back(), rpa);
+    resolver.resolve(rpa, i);
+  }
+
+  size_t removed = rng() % n;
+  std::string delta = "@2:-" + to_hex(irks[removed]) + ":+" + to_hex(added[0]) + ":+" + to_hex(added[1]);
+  auto result = apply_irk_delta(delta, resolver);
+  bool stale = apply_irk_delta("@2:-" + to_hex(irks[0]), resolver).stale;
+  irks[removed] = Irk{};
+  irks.insert(irks.end(), added.begin(), added.end());
+
+  bool ok = result.added == 2 && result.removed == 1 && !result.stale && stale && resolver.generation() == 2 &&
+            resolver.size() == n + 1;
+  for (uint64_t addr : addrs) {
+    uint8_t rpa[6];
+    rpa_from_uint64(addr, rpa);
+    int expected = reference_resolve(rpa, irks);
+    if (expected == (int) removed) {
+      expected = -1;
+    }
+    ok &= resolver.resolve(rpa, 0) == expected;
+  }
+  if (!ok) {
+    printf("MISMATCH after delta with %zu IRKs\n", n);
+  }
+  return ok;
+}
+
+// An identity's RPA stays current until a new one resolves to it, and each change counts as a rotation
+static bool verify_rotation() {
+  auto irks = random_irks(2);
+  IrkResolver resolver;
+  load(resolver, irks);
+
+  uint8_t first[6], second[6];
+  rpa_from_uint64(make_rpa(&irks[1]), first);
+  rpa_from_uint64(make_rpa(&irks[1]), second);
+  bool ok = resolver.resolve(first, 1000) == 1 && resolver.resolve(first, 2000) == 1 &&
+            resolver.resolve(second, 901000) == 1 && resolver.resolve(second, 902000) == 1;
+
+  auto &identities = resolver.identities();
+  auto &state = identities.state(1);
+  ok &= identities.address(1) == rpa_to_uint64(second) && identities.address(0) == 0 && state.rotations == 1 &&
+        state.rotation_interval_ms == 900000 && state.first_seen_ms == 1000 && state.last_seen_ms == 902000 &&
+        identities.mean_rotation_interval_ms() == 900000;
+  if (!ok) {
+    printf("MISMATCH in identity rotation tracking\n");
+  }
+  return ok;
+}
+
+struct Workload {
+  std::vector<uint64_t> adverts;
+};
+
+// hit_ratio of the RPA adverts repeat an address that is still cached; the
+// others are fresh, and one in five of those is a known identity rotating to
+// a new RPA, which replaces its previous one
+static Workload make_workload(const std::vector<Irk> &irks, size_t count, double hit_ratio, double non_rpa_ratio) {
+  std::uniform_real_distribution<double> unit(0, 1);
+  Workload w;
+  std::vector<uint64_t> recent;
+  std::vector<uint64_t> current(irks.size(), 0);
+  for (size_t i = 0; i < count; i++) {
+    if (unit(rng) < non_rpa_ratio) {
+      w.adverts.push_back(make_non_rpa());
+    } else if (!recent.empty() && unit(rng) < hit_ratio) {
+      w.adverts.push_back(recent[rng() % recent.size()]);
+    } else {
+      uint64_t addr, rotated_out = 0;
+      if (unit(rng) < 0.2) {
+        size_t identity = rng() % irks.size();
+        addr = make_rpa(&irks[identity]);
+        rotated_out = current[identity];
+        current[identity] = addr;
+      } else {
+        addr = make_rpa(nullptr);
+      }
+      // a rotated-out RPA is never repeated; otherwise stay well inside the cache so repeats really are hits
+      auto it = std::find(recent.begin(), recent.end(), rotated_out);
+      if (rotated_out != 0 && it != recent.end()) {
+        *it = addr;
+      } else if (recent.size() < RpaCache::SIZE / 4) {
+        recent.push_back(addr);
+      } else {
+        recent[rng() % recent.size()] = addr;
+      }
+      w.adverts.push_back(addr);
+    }
+  }
+  return w;
+}
+
+static void bench(size_t n, double hit_ratio, double non_rpa_ratio) {
+  auto irks = random_irks(n);
+  IrkResolver resolver;
+  load(resolver, irks);
+
+  size_t count = std::max<size_t>(2000, 400000 / n);
+  auto w = make_workload(irks, count, hit_ratio, non_rpa_ratio);
+
+  uint32_t hits0 = resolver.cache_hits(), misses0 = resolver.cache_misses();
+  int matches = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t addr : w.adverts) {
+    // same short-circuit as IrkResolverComponent::parse_device
+    if (!is_rpa(addr)) {
+      continue;
+    }
+    uint8_t rpa[6];
+    rpa_from_uint64(addr, rpa);
+    if (resolver.resolve(rpa, 0) >= 0) {
+      matches++;
+    }
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  uint32_t hits = resolver.cache_hits() - hits0, misses = resolver.cache_misses() - misses0;
+  double ns = elapsed / count;
+  printf("%6zu %8.0f%% %8.0f%% %8.1f%% %12.1f %14.0f %8d\n", n, hit_ratio * 100, non_rpa_ratio * 100,
+         hits + misses ? 100.0 * hits / (hits + misses) : 0.0, ns, 1e9 / ns, matches);
+}
+
+static void bench_loader(size_t n) {
+  auto irks = random_irks(n);
+  std::string list;
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for (auto &irk : irks) {
+    const uint8_t *k = irk.key;
+    for (int i = 0; i < 15; i += 3) {
+      uint32_t v = (k[i] << 16) | (k[i + 1] << 8) | k[i + 2];
+      for (int j = 18; j >= 0; j -= 6) {
+        list += alphabet[(v >> j) & 0x3f];
+      }
+    }
+    list += alphabet[k[15] >> 2];
+    list += alphabet[(k[15] & 0x3) << 4];
+    list += "==:";
+  }
+
+  IrkResolver resolver;
+  int rounds = std::max<int>(5, 20000 / n);
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    auto &table = resolver.begin_update();
+    parse_irk_list(list, table);
+    resolver.publish();
+  }
+  auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  bool ok = resolver.size() == n && memcmp(resolver.table().irks(), irks.data(), n * sizeof(Irk)) == 0;
+  printf("%6zu %12.1f %12.3f%s\n", n, elapsed / rounds, elapsed / rounds / n, ok ? "" : " DECODE MISMATCH");
+}
+
+int main() {
+  static const size_t irk_counts[] = {1, 10, 50, 100, 500, 1000};
+
+#ifdef IRK_RESOLVER_BITSLICED
+  printf("IrkResolver AES: bitsliced\n\n");
+#else
+  printf("IrkResolver AES: %s\n\n", host_aes_backend_name(host_aes_backend()));
+#endif
+
+  bool ok = verify_parser() && verify_rotation();
+  for (size_t n : irk_counts) {
+    ok &= verify(n) && verify_delta(n);
+  }
+  printf("verify against reference: %s\n\n", ok ? "ok" : "FAILED");
+
+  printf("%6s %9s %9s %9s %12s %14s %8s\n", "irks", "hit", "non-rpa", "actual", "ns/advert", "adverts/s", "matches");
+  for (size_t n : irk_counts) {
+    for (double hit_ratio : {0.0, 0.5, 0.95, 0.99}) {
+      for (double non_rpa_ratio : {0.0, 0.5}) {
+        bench(n, hit_ratio, non_rpa_ratio);
+      }
+    }
+  }
+
+  printf("\nIRK list loader (parse + publish)\n%6s %12s %12s\n", "irks", "us/load", "us/irk");
+  for (size_t n : irk_counts) {
+    bench_loader(n);
+  }
+
+  return ok ? 0 : 1;
+}
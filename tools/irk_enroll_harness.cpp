@@ -0,0 +1,481 @@
+// Host-side harness for irk_enrollment's session state machine.
+//
+//   g++ -O2 -std=gnu++17 -I custom_components/irk_enrollment -o irk_enroll_harness
+//       tools/irk_enroll_harness.cpp custom_components/irk_enrollment/enrollment_session.cpp
+//
+//   irk_enroll_harness [options] [script]
+//
+//   --phones <n>             generate n phones instead of reading a script, 20 by default
+//   --interval <ms>          mean gap between generated phones arriving, 2000 by default
+//   --seed <n>               seed for the generated phones
+//   --print-script           print the generated script instead of running it
+//   --sessions <n>           max_sessions, 3 by default
+//   --pairing-timeout <ms>   pairing_timeout, 60000 by default
+//   --gap-latency <ms>       how long the mocked stack takes to confirm a disconnect or bond removal, 40 by default
+//   --retry <ms>             how long a phone turned away waits before connecting again, 3000 by default
+//   --loop <ms>              main loop period, 16 by default
+//   --auth-only              deliver pairing-complete as the only GAP event, leaving out the identity key and
+//                            bond removal events, as when ESP32BLE doesn't pass them on
+//
+// A script has one phone per line, "<arrival ms> <kind> [<pairing ms>]":
+//
+//   ok       pairs pairing ms after connecting, sharing its identity key
+//   no_key   pairs without sharing an identity key
+//   fail     pairing fails after pairing ms
+//   timeout  never pairs
+//   leave    disconnects after pairing ms, before pairing
+//
+// The session code is the component's own (enrollment_session.cpp). It runs
+// against a mocked Bluetooth stack that stands in for the esp_ble calls the
+// component makes: connecting, disconnecting, creating the bond and the
+// identity key when a phone pairs, reading the bond store, and removing the
+// bond. Time is simulated, so a
+// run of hundreds of phones takes milliseconds. Every phone must end with the
+// outcome its kind implies, every captured IRK must be its phone's, and no
+// bond or connection may be left behind; it exits non-zero otherwise. It then
+// reports the latency of each phase of a successful enrollment and the
+// enrollment throughput.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "enrollment_session.h"
+
+using namespace esphome::irk_enrollment;
+
+enum PhoneKind { PHONE_OK, PHONE_NO_KEY, PHONE_FAIL, PHONE_TIMEOUT, PHONE_LEAVE };
+static const char *const KIND_NAMES[] = {"ok", "no_key", "fail", "timeout", "leave"};
+
+struct Phone {
+  uint32_t arrival_ms;
+  PhoneKind kind;
+  uint32_t pairing_ms;
+  uint8_t address[6];
+  uint8_t identity[6];
+  uint8_t irk[16];
+  // Filled in as the run goes
+  bool connected;
+  int connects;
+  int captures;
+  bool finished;
+  EnrollmentOutcome outcome;
+  EnrollmentTimings timings;
+};
+
+enum EventType { EV_CONNECT, EV_PAIR, EV_LEAVE, EV_DISCONNECTED, EV_BOND_REMOVED };
+
+struct Event {
+  uint32_t at_ms;
+  uint64_t seq;
+  EventType type;
+  size_t phone;
+  bool operator>(const Event &other) const {
+    return this->at_ms != other.at_ms ? this->at_ms > other.at_ms : this->seq > other.seq;
+  }
+};
+
+struct Options {
+  size_t sessions = 3;
+  uint32_t pairing_timeout_ms = 60000;
+  uint32_t gap_latency_ms = 40;
+  uint32_t retry_ms = 3000;
+  uint32_t loop_ms = 16;
+  bool auth_only = false;
+};
+
+/*
+ * What Bluedroid does for the component, minus the radio: it tracks which
+ * phones are connected and which have a bond, and confirms disconnects and
+ * bond removals gap_latency_ms after they were asked for. A phone that shares
+ * its identity key has its bond stored under its identity address.
+ */
+class MockStack : public EnrollmentStack {
+ public:
+  MockStack(std::vector<Phone> &phones, uint32_t gap_latency_ms) : phones_(phones), gap_latency_ms_(gap_latency_ms) {}
+
+  bool disconnect(const uint8_t *address) override {
+    int phone = this->find_(address, false);
+    this->disconnects++;
+    if (phone < 0 || !this->phones_[phone].connected) {
+      return false;
+    }
+    this->schedule(this->now_ms + this->gap_latency_ms_, EV_DISCONNECTED, phone);
+    return true;
+  }
+
+  bool remove_bond(const uint8_t *address) override {
+    this->removals++;
+    int phone = this->find_(address, true);
+    if (phone < 0 || !this->bonds.count(phone)) {
+      // Bluedroid accepts the call and reports the failure in the completion event
+      this->stray_removals++;
+      return true;
+    }
+    this->schedule(this->now_ms + this->gap_latency_ms_, EV_BOND_REMOVED, phone);
+    return true;
+  }
+
+  bool bonded_identity(const uint8_t *address, uint8_t *irk, uint8_t *identity) override {
+    int phone = this->find_(address, false);
+    if (phone < 0 || !this->bonds.count(phone) || this->phones_[phone].kind != PHONE_OK) {
+      return false;
+    }
+    memcpy(irk, this->phones_[phone].irk, 16);
+    memcpy(identity, this->phones_[phone].identity, 6);
+    return true;
+  }
+
+  bool has_bond(const uint8_t *address) override {
+    int phone = this->find_(address, true);
+    return phone >= 0 && this->bonds.count(phone);
+  }
+
+  void schedule(uint32_t at_ms, EventType type, size_t phone) {
+    this->events.push(Event{at_ms, this->seq_++, type, phone});
+  }
+
+  uint32_t now_ms{0};
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::set<size_t> bonds;
+  size_t disconnects{0};
+  size_t removals{0};
+  size_t stray_removals{0};
+
+ protected:
+  // Phones are found by connection address, or by the address their bond is stored under
+  int find_(const uint8_t *address, bool bond) {
+    for (size_t i = 0; i < this->phones_.size(); i++) {
+      const Phone &p = this->phones_[i];
+      const uint8_t *a = bond && p.kind != PHONE_NO_KEY ? p.identity : p.address;
+      if (memcmp(a, address, 6) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  std::vector<Phone> &phones_;
+  uint32_t gap_latency_ms_;
+  uint64_t seq_{0};
+};
+
+static void random_bytes(std::mt19937_64 &rng, uint8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = rng();
+  }
+}
+
+static std::vector<Phone> generate(size_t count, uint32_t interval_ms, std::mt19937_64 &rng) {
+  std::exponential_distribution<double> gap(1.0 / std::max<uint32_t>(interval_ms, 1));
+  std::uniform_int_distribution<uint32_t> pairing(2000, 12000);
+  std::vector<Phone> phones(count);
+  double at = 0;
+  for (size_t i = 0; i < count; i++) {
+    Phone &p = phones[i];
+    p.arrival_ms = (uint32_t) at;
+    at += gap(rng);
+    // Most phones enroll; every twentieth does each of the things that can go wrong
+    static const PhoneKind MIX[] = {PHONE_NO_KEY, PHONE_FAIL, PHONE_TIMEOUT, PHONE_LEAVE};
+    p.kind = i % 20 < 16 ? PHONE_OK : MIX[i % 20 - 16];
+    p.pairing_ms = pairing(rng);
+  }
+  return phones;
+}
+
+static bool read_script(const char *path, std::vector<Phone> &phones) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    return false;
+  }
+  char line[256];
+  int number = 0;
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    number++;
+    char kind[16];
+    unsigned arrival, pairing = 5000;
+    if (line[0] == '#' || sscanf(line, "%u %15s %u", &arrival, kind, &pairing) < 2) {
+      continue;
+    }
+    Phone p{};
+    p.arrival_ms = arrival;
+    p.pairing_ms = pairing;
+    auto *name = std::find_if(std::begin(KIND_NAMES), std::end(KIND_NAMES),
+                              [&](const char *n) { return strcmp(n, kind) == 0; });
+    if (name == std::end(KIND_NAMES)) {
+      fprintf(stderr, "%s:%d: unknown phone kind %s\n", path, number, kind);
+      fclose(f);
+      return false;
+    }
+    p.kind = (PhoneKind) (name - std::begin(KIND_NAMES));
+    phones.push_back(p);
+  }
+  fclose(f);
+  return true;
+}
+
+static EnrollmentOutcome expected_outcome(PhoneKind kind) {
+  switch (kind) {
+    case PHONE_OK:
+      return ENROLLMENT_CAPTURED;
+    case PHONE_NO_KEY:
+      return ENROLLMENT_NO_IRK;
+    case PHONE_FAIL:
+      return ENROLLMENT_PAIRING_FAILED;
+    case PHONE_TIMEOUT:
+      return ENROLLMENT_PAIRING_TIMEOUT;
+    default:
+      return ENROLLMENT_LOST;
+  }
+}
+
+static void report_phase(const char *name, std::vector<uint32_t> values) {
+  if (values.empty()) {
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  auto at = [&](double q) { return values[std::min(values.size() - 1, (size_t) (q * values.size()))]; };
+  printf("  %-26s min %6u  p50 %6u  p90 %6u  max %6u ms\n", name, values.front(), at(0.5), at(0.9), values.back());
+}
+
+static bool run(std::vector<Phone> &phones, const Options &options) {
+  MockStack stack(phones, options.gap_latency_ms);
+  EnrollmentSessions sessions(&stack, options.sessions, options.pairing_timeout_ms, 5000);
+
+  std::mt19937_64 rng(0x9e3779b9);
+  for (size_t i = 0; i < phones.size(); i++) {
+    random_bytes(rng, phones[i].address, 6);
+    random_bytes(rng, phones[i].identity, 6);
+    random_bytes(rng, phones[i].irk, 16);
+    stack.schedule(phones[i].arrival_ms, EV_CONNECT, i);
+  }
+
+  auto phone_of = [&](const EnrollmentSession &session) {
+    for (size_t i = 0; i < phones.size(); i++) {
+      if (memcmp(phones[i].address, session.address, 6) == 0) {
+        return (int) i;
+      }
+    }
+    return -1;
+  };
+  bool ok = true;
+  size_t refused = 0;
+  sessions.set_on_captured([&](const EnrollmentSession &session) {
+    int i = phone_of(session);
+    if (i < 0 || memcmp(session.irk, phones[i].irk, 16) != 0 || memcmp(session.identity, phones[i].identity, 6) != 0) {
+      fprintf(stderr, "captured the wrong IRK or identity for phone %d\n", i);
+      ok = false;
+      return;
+    }
+    phones[i].captures++;
+  });
+  sessions.set_on_finished([&](const EnrollmentSession &session) {
+    int i = phone_of(session);
+    if (i < 0) {
+      fprintf(stderr, "a session finished for an unknown phone\n");
+      ok = false;
+      return;
+    }
+    phones[i].finished = true;
+    phones[i].outcome = session.outcome;
+    phones[i].timings = session.timings;
+    if (session.gap_timeouts > 0) {
+      fprintf(stderr, "phone %d: %u stack calls were never confirmed\n", i, session.gap_timeouts);
+      ok = false;
+    }
+  });
+
+  auto wall_start = std::chrono::steady_clock::now();
+  size_t events = 0, ticks = 0;
+  bool open = false;
+  // Main loop ticks: the stack's events are dispatched first, as ESP32BLE::loop() does, then sessions advance
+  for (uint32_t now = 0; !stack.events.empty() || open; now += options.loop_ms) {
+    stack.now_ms = now;
+    while (!stack.events.empty() && stack.events.top().at_ms <= now) {
+      Event ev = stack.events.top();
+      stack.events.pop();
+      events++;
+      Phone &p = phones[ev.phone];
+      switch (ev.type) {
+        case EV_CONNECT:
+          p.connected = true;
+          p.connects++;
+          if (!sessions.connected(p.address, now)) {
+            // The component drops the connection, and the phone tries again later
+            refused++;
+            stack.disconnect(p.address);
+            stack.schedule(now + options.retry_ms, EV_CONNECT, ev.phone);
+          } else if (p.kind == PHONE_LEAVE) {
+            stack.schedule(now + p.pairing_ms, EV_LEAVE, ev.phone);
+          } else if (p.kind != PHONE_TIMEOUT) {
+            stack.schedule(now + p.pairing_ms, EV_PAIR, ev.phone);
+          }
+          break;
+        case EV_PAIR:
+          if (!p.connected) {
+            break;
+          }
+          if (p.kind == PHONE_FAIL) {
+            sessions.pairing_complete(p.address, false, now);
+            break;
+          }
+          // Key distribution comes before the pairing-complete event, and the bond exists by then
+          if (p.kind == PHONE_OK && !options.auth_only) {
+            sessions.identity_key(p.address, p.irk, p.identity);
+          }
+          stack.bonds.insert(ev.phone);
+          sessions.pairing_complete(p.address, true, now);
+          break;
+        case EV_LEAVE:
+        case EV_DISCONNECTED:
+          if (p.connected) {
+            p.connected = false;
+            sessions.disconnected(p.address, now);
+          }
+          break;
+        case EV_BOND_REMOVED:
+          stack.bonds.erase(ev.phone);
+          if (!options.auth_only) {
+            sessions.bond_removed(p.kind == PHONE_NO_KEY ? p.address : p.identity, now);
+          }
+          break;
+      }
+    }
+    open = sessions.advance(now);
+    ticks++;
+    if (now > 24 * 3600 * 1000u) {
+      fprintf(stderr, "still running after a simulated day\n");
+      return false;
+    }
+  }
+  double wall_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - wall_start).count();
+
+  size_t outcomes[5] = {0};
+  uint32_t first_ms = UINT32_MAX, last_ms = 0;
+  std::vector<uint32_t> pairing, capture, disconnect, removal, published, total;
+  for (size_t i = 0; i < phones.size(); i++) {
+    const Phone &p = phones[i];
+    if (!p.finished || p.outcome != expected_outcome(p.kind) || p.captures != (p.kind == PHONE_OK ? 1 : 0)) {
+      fprintf(stderr, "phone %zu (%s): finished %d, outcome %d, %d captures\n", i, KIND_NAMES[p.kind], p.finished,
+              p.outcome, p.captures);
+      ok = false;
+      continue;
+    }
+    if (p.connected) {
+      fprintf(stderr, "phone %zu (%s) was left connected\n", i, KIND_NAMES[p.kind]);
+      ok = false;
+    }
+    outcomes[p.outcome]++;
+    const auto &t = p.timings;
+    first_ms = std::min(first_ms, p.arrival_ms);
+    last_ms = std::max(last_ms, std::max(t.removed_ms, t.disconnected_ms));
+    if (p.outcome == ENROLLMENT_CAPTURED) {
+      pairing.push_back(t.paired_ms - t.connected_ms);
+      capture.push_back(t.captured_ms - t.paired_ms);
+      disconnect.push_back(t.disconnected_ms - t.captured_ms);
+      removal.push_back(t.removed_ms - t.disconnected_ms);
+      published.push_back(t.captured_ms - t.connected_ms);
+      total.push_back(t.removed_ms - t.connected_ms);
+    }
+  }
+  if (!stack.bonds.empty()) {
+    fprintf(stderr, "%zu bonds were left behind\n", stack.bonds.size());
+    ok = false;
+  }
+  if (sessions.active() != 0) {
+    fprintf(stderr, "%zu sessions were left open\n", sessions.active());
+    ok = false;
+  }
+
+  printf("%zu phones, %zu sessions: %zu enrolled, %zu without a key, %zu failed, %zu timed out, %zu left\n",
+         phones.size(), options.sessions, outcomes[ENROLLMENT_CAPTURED], outcomes[ENROLLMENT_NO_IRK],
+         outcomes[ENROLLMENT_PAIRING_FAILED], outcomes[ENROLLMENT_PAIRING_TIMEOUT], outcomes[ENROLLMENT_LOST]);
+  printf("%zu connections turned away, %zu disconnects and %zu bond removals asked for (%zu without a bond)\n", refused,
+         stack.disconnects, stack.removals, stack.stray_removals);
+  printf("phase latency of enrolled phones:\n");
+  report_phase("connect -> paired", pairing);
+  report_phase("paired -> IRK captured", capture);
+  report_phase("captured -> disconnected", disconnect);
+  report_phase("disconnected -> bond gone", removal);
+  report_phase("connect -> IRK published", published);
+  report_phase("connect -> bond gone", total);
+  if (last_ms > first_ms) {
+    printf("throughput: %.1f enrollments/minute over %.1f simulated seconds\n",
+           outcomes[ENROLLMENT_CAPTURED] * 60000.0 / (last_ms - first_ms), (last_ms - first_ms) / 1000.0);
+  }
+  printf("state machine: %zu events and %zu loop ticks in %.2f ms, %.0f ns per call\n", events, ticks, wall_ns / 1e6,
+         wall_ns / std::max<size_t>(events + ticks, 1));
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  size_t count = 20;
+  uint32_t interval_ms = 2000;
+  uint64_t seed = 1;
+  bool print_script = false;
+  const char *script = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s needs a value\n", arg.c_str());
+        exit(2);
+      }
+      return strtoull(argv[++i], nullptr, 0);
+    };
+    if (arg == "--phones") {
+      count = value();
+    } else if (arg == "--interval") {
+      interval_ms = value();
+    } else if (arg == "--seed") {
+      seed = value();
+    } else if (arg == "--print-script") {
+      print_script = true;
+    } else if (arg == "--sessions") {
+      options.sessions = std::max<size_t>(1, value());
+    } else if (arg == "--pairing-timeout") {
+      options.pairing_timeout_ms = value();
+    } else if (arg == "--gap-latency") {
+      options.gap_latency_ms = value();
+    } else if (arg == "--retry") {
+      options.retry_ms = value();
+    } else if (arg == "--loop") {
+      options.loop_ms = std::max<uint32_t>(1, value());
+    } else if (arg == "--auth-only") {
+      options.auth_only = true;
+    } else if (arg[0] != '-' && script == nullptr) {
+      script = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [options] [script]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<Phone> phones;
+  if (script != nullptr) {
+    if (!read_script(script, phones)) {
+      fprintf(stderr, "cannot read %s\n", script);
+      return 2;
+    }
+  } else {
+    std::mt19937_64 rng(seed);
+    phones = generate(count, interval_ms, rng);
+  }
+  if (print_script) {
+    for (const auto &p : phones) {
+      printf("%u %s %u\n", p.arrival_ms, KIND_NAMES[p.kind], p.pairing_ms);
+    }
+    return 0;
+  }
+  return run(phones, options) ? 0 : 1;
+}
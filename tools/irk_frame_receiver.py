@@ -0,0 +1,83 @@
+import argparse
+import json
+import os
+import sys
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from irk_frames import FrameError, decode_frame
+
+parser = argparse.ArgumentParser(description='stand-in for Home Assistant that decodes irk_resolver batch frames')
+parser.add_argument('--port', type=int, default=8123, help='port to accept POST /api/events/<event> on')
+parser.add_argument('--file', help='decode base64 frames, one per line, from this file (- for stdin) instead of listening')
+parser.add_argument('--irks', help='serve this IRK list file as the state of sensor.irk_prefilter, for tools/irkd')
+parser.add_argument('-v', '--verbose', help='print every record', action='store_true')
+args = parser.parse_args()
+
+totals = {'frames': 0, 'records': 0, 'bytes': 0, 'errors': 0}
+
+
+def handle_frame(text, source=None):
+    try:
+        frame = decode_frame(text)
+    except (FrameError, ValueError) as e:
+        totals['errors'] += 1
+        print(f'bad frame from {source}: {e}')
+        return
+    records = frame['records']
+    totals['frames'] += 1
+    totals['records'] += len(records)
+    totals['bytes'] += len(text)
+    span = (records[-1][0] - records[0][0]) & 0xffffffff if records else 0
+    print(f"{source or frame['source']}: {len(records)} records over {span} ms, generation {frame['generation']}")
+    if args.verbose:
+        for ts, key, rssi in records:
+            print(f'  {ts:10d} identity {key:08x} rssi {rssi}')
+
+
+def print_totals():
+    if totals['records']:
+        print(f"{totals['frames']} frames, {totals['records']} records, "
+              f"{totals['bytes'] / totals['records']:.1f} base64 bytes/record, {totals['errors']} bad frames")
+
+
+class EventHandler(BaseHTTPRequestHandler):
+    def do_POST(self):
+        event = self.path.rsplit('/', 1)[-1]
+        data = json.loads(self.rfile.read(int(self.headers.get('Content-Length', 0))) or b'{}')
+        if 'frame' in data:
+            handle_frame(data['frame'], data.get('source'))
+        else:
+            print(f'{event}: {data}')
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.end_headers()
+        self.wfile.write(json.dumps({'message': f'Event {event} fired.'}).encode())
+
+    def do_GET(self):
+        if self.path != '/api/states/sensor.irk_prefilter' or not args.irks:
+            self.send_response(404)
+            self.end_headers()
+            return
+        with open(args.irks) as f:
+            state = f.read().strip()
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.end_headers()
+        self.wfile.write(json.dumps({'entity_id': 'sensor.irk_prefilter', 'state': state}).encode())
+
+    def log_message(self, format, *args):
+        pass
+
+
+if args.file:
+    for line in sys.stdin if args.file == '-' else open(args.file):
+        if line.strip():
+            handle_frame(line.strip())
+    print_totals()
+else:
+    print(f'listening on :{args.port}')
+    try:
+        HTTPServer(('', args.port), EventHandler).serve_forever()
+    except KeyboardInterrupt:
+        print_totals()
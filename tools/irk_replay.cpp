@@ -0,0 +1,200 @@
+// Replays a binary advertisement trace (see custom_components/irk_resolver/trace.h)
+// through the resolver core, at the recorded pace or as fast as possible.
+//
+//   g++ -O2 -std=gnu++17 -I custom_components/irk_resolver -o irk_replay tools/irk_replay.cpp
+//       custom_components/irk_resolver/rpa_resolver.cpp custom_components/irk_resolver/trace.cpp
+//       custom_components/irk_resolver/frame.cpp custom_components/irk_resolver/metrics.cpp
+//       custom_components/irk_resolver/aes_host.cpp
+//
+// Add -DIRK_RESOLVER_METRICS for the AES work and resolve time histogram the
+// component's metrics: option reports.
+//
+//   irk_replay [--max-speed] [--frames <file>] <irk list file> <trace file>
+//
+// --frames writes the batch frames the component would have sent (32 records,
+// 1 s deadline), base64, one per line, for tools/irk_frame_receiver.py --file.
+// The IRK list file holds the same colon-separated base64 or hex list as
+// sensor.irk_prefilter. Traces dumped to the device log can be turned into a
+// trace file with tools/irk_trace_from_log.py.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "rpa_resolver.h"
+#include "trace.h"
+
+using namespace esphome::irk_resolver;
+
+// esp_ble_addr_type_t's BLE_ADDR_TYPE_RANDOM
+static const uint8_t ADDRESS_TYPE_RANDOM = 1;
+
+// The component's batch: defaults
+static const size_t FRAME_RECORDS = 32;
+static const uint32_t FRAME_DEADLINE_MS = 1000;
+
+static void write_frame(FILE *out, const std::vector<uint8_t> &frame) {
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for (size_t i = 0; i < frame.size(); i += 3) {
+    size_t n = std::min<size_t>(3, frame.size() - i);
+    uint32_t v = frame[i] << 16 | (n > 1 ? frame[i + 1] << 8 : 0) | (n > 2 ? frame[i + 2] : 0);
+    for (size_t j = 0; j < 4; j++) {
+      fputc(j <= n ? alphabet[(v >> (18 - 6 * j)) & 0x3f] : '=', out);
+    }
+  }
+  fputc('\n', out);
+}
+
+int main(int argc, char **argv) {
+  bool max_speed = false;
+  FILE *frames_out = nullptr;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (strcmp(argv[arg], "--max-speed") == 0) {
+      max_speed = true;
+    } else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc) {
+      frames_out = fopen(argv[++arg], "w");
+      if (frames_out == nullptr) {
+        perror(argv[arg]);
+        return 1;
+      }
+    } else {
+      break;
+    }
+  }
+  if (argc - arg != 2) {
+    fprintf(stderr, "usage: %s [--max-speed] [--frames <file>] <irk list file> <trace file>\n", argv[0]);
+    return 2;
+  }
+
+  std::ifstream irk_file(argv[arg]);
+  if (!irk_file) {
+    fprintf(stderr, "cannot read %s\n", argv[arg]);
+    return 1;
+  }
+  std::stringstream irk_list;
+  irk_list << irk_file.rdbuf();
+  IrkResolver resolver;
+  std::string list = irk_list.str();
+  size_t irks = parse_irk_list(list, resolver.begin_update()).loaded;
+  resolver.publish();
+
+  int fd = open(argv[arg + 1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(TraceHeader)) {
+    fprintf(stderr, "cannot read %s\n", argv[arg + 1]);
+    return 1;
+  }
+  auto *base = (const uint8_t *) mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  auto *header = (const TraceHeader *) base;
+  if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+      header->record_size != sizeof(TraceRecord)) {
+    fprintf(stderr, "%s is not a version %u trace\n", argv[arg + 1], TRACE_VERSION);
+    return 1;
+  }
+  size_t count = (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+  if (header->record_count != 0 && header->record_count < count) {
+    count = header->record_count;
+  }
+  auto *records = (const TraceRecord *) (base + sizeof(TraceHeader));
+
+  size_t rpas = 0, resolved = 0, frames = 0, frame_bytes = 0;
+  FrameEncoder batch(FRAME_RECORDS, count > 0 ? records[0].source : 0);
+  auto send_frame = [&]() {
+    auto &frame = batch.finish(resolver.generation());
+    frames++;
+    frame_bytes += frame.size();
+    if (frames_out != nullptr) {
+      write_frame(frames_out, frame);
+    }
+    batch.clear();
+  };
+  std::map<int, size_t> per_identity;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    const TraceRecord &r = records[i];
+    if (!max_speed) {
+      // timestamps are unsigned, so the difference survives a millis() wrap
+      uint32_t offset = r.timestamp_ms - records[0].timestamp_ms;
+      std::this_thread::sleep_until(start + std::chrono::milliseconds(offset));
+    }
+
+    if (!batch.empty() && r.timestamp_ms - batch.first_ms() >= FRAME_DEADLINE_MS) {
+      send_frame();
+    }
+
+    // same short-circuit as IrkResolverComponent::parse_device
+    if (r.address_type != ADDRESS_TYPE_RANDOM || !is_rpa(rpa_to_uint64(r.address))) {
+      continue;
+    }
+    rpas++;
+    int identity = resolver.resolve(r.address, r.timestamp_ms);
+    if (identity >= 0) {
+      resolved++;
+      per_identity[identity]++;
+      uint32_t key = frame_identity_key(resolver.irk(identity));
+      if (!batch.add(r.timestamp_ms, key, r.rssi)) {
+        send_frame();
+        batch.add(r.timestamp_ms, key, r.rssi);
+      }
+      if (batch.full()) {
+        send_frame();
+      }
+    }
+  }
+  if (!batch.empty()) {
+    send_frame();
+  }
+  if (frames_out != nullptr) {
+    fclose(frames_out);
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%zu IRKs, %zu adverts, %zu RPAs, %zu resolved\n", irks, count, rpas, resolved);
+  printf("cache hits %u, misses %u\n", resolver.cache_hits(), resolver.cache_misses());
+  if (frames > 0) {
+    printf("%zu batch frames, %.1f bytes/resolved advert\n", frames, (double) frame_bytes / resolved);
+  }
+  printf("%.3f s, %.0f adverts/s, %.1f ns/advert\n", elapsed, count / elapsed, elapsed * 1e9 / count);
+  auto &identities = resolver.identities();
+  for (auto &it : per_identity) {
+    auto &state = identities.state(it.first);
+    printf("  identity %d: %zu, %u rotations, last RPA lasted %.1f min\n", it.first, it.second, state.rotations,
+           state.rotation_interval_ms / 60000.0);
+  }
+  if (identities.mean_rotation_interval_ms() != 0) {
+    printf("mean rotation interval %.1f min\n", identities.mean_rotation_interval_ms() / 60000.0);
+  }
+#ifdef IRK_RESOLVER_METRICS
+  auto &metrics = resolver.metrics();
+  printf("%u AES blocks, %.1f per RPA\n", metrics.aes_blocks, rpas > 0 ? (double) metrics.aes_blocks / rpas : 0.0);
+  printf("resolve time median <%u us, p99 <%u us\n", metrics.resolve_us.quantile_us(0.5f),
+         metrics.resolve_us.quantile_us(0.99f));
+  for (size_t b = 0; b < LatencyHistogram::BUCKETS; b++) {
+    if (metrics.resolve_us.bucket(b) > 0) {
+      printf("  <%u us: %u\n", LatencyHistogram::bucket_limit_us(b), metrics.resolve_us.bucket(b));
+    }
+  }
+#endif
+
+  munmap((void *) base, st.st_size);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,156 @@
+// Host-side stress test for the resolver task and its SPSC rings.
+//
+//   g++ -O2 -std=gnu++17 -pthread -I custom_components/irk_resolver -o irk_ring_stress
+//       tools/irk_ring_stress.cpp custom_components/irk_resolver/rpa_resolver.cpp
+//       custom_components/irk_resolver/resolver_task.cpp custom_components/irk_resolver/aes_host.cpp
+//
+//   irk_ring_stress [adverts] [ring size]
+//
+// One thread submits adverts while another polls results and keeps adding
+// IRKs through with_resolver(), the way the component's loop() does. It runs
+// twice: flooding the ring, and then backing off whenever the ring is nearly
+// full to measure how fast the task drains it. Every result is checked
+// against the identity its address was generated for, and every advert must
+// be either processed or counted as dropped. Exits non-zero otherwise.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "resolver_task.h"
+
+using namespace esphome::irk_resolver;
+
+static const size_t NUM_IRKS = 50;
+static const size_t NUM_ADDRESSES = 4096;
+
+struct Pool {
+  std::vector<Irk> irks;
+  std::vector<uint64_t> addresses;
+  // The identity each address must resolve to, or -1
+  std::unordered_map<uint64_t, int> expected;
+};
+
+static Pool make_pool(std::mt19937_64 &rng) {
+  Pool pool;
+  pool.irks.resize(NUM_IRKS);
+  for (auto &irk : pool.irks) {
+    for (auto &b : irk.key) {
+      b = rng();
+    }
+  }
+  // a quarter of the addresses resolve
+  for (size_t i = 0; i < NUM_ADDRESSES; i++) {
+    uint8_t rpa[6];
+    for (auto &b : rpa) {
+      b = rng();
+    }
+    rpa[5] = (rpa[5] & 0x3f) | 0x40;
+    int identity = i % 4 == 0 ? rng() % NUM_IRKS : -1;
+    if (identity >= 0) {
+      uint8_t plain_text[16], cipher_text[16];
+      ble_ll_rpa_plain_text(rpa, plain_text);
+      bt_encrypt_be(pool.irks[identity].key, plain_text, cipher_text);
+      rpa[0] = cipher_text[15];
+      rpa[1] = cipher_text[14];
+      rpa[2] = cipher_text[13];
+    }
+    pool.addresses.push_back(rpa_to_uint64(rpa));
+    pool.expected[pool.addresses.back()] = identity;
+  }
+  return pool;
+}
+
+static bool run(const Pool &pool, size_t adverts, size_t ring_size, bool paced) {
+  std::mt19937_64 rng(2);
+  IrkResolver resolver;
+  auto &table = resolver.begin_update();
+  for (auto &irk : pool.irks) {
+    table.add(irk.key);
+  }
+  resolver.publish();
+
+  ResolverTask task(resolver, ring_size);
+  task.start(1, 5);
+
+  std::atomic<bool> producing{true};
+  std::atomic<size_t> submitted{0};
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&]() {
+    std::mt19937_64 pick(1);
+    for (size_t i = 0; i < adverts; i++) {
+      while (paced && task.queued() >= ring_size - 1) {
+        std::this_thread::yield();
+      }
+      task.submit(pool.addresses[pick() % pool.addresses.size()], -60, i);
+      submitted++;
+    }
+    producing = false;
+  });
+
+  // The loop() side: poll results, and add IRKs that no pooled address resolves to, which must not disturb
+  // the identities of the others
+  size_t resolved = 0, mismatches = 0, updates = 0;
+  ResolvedRecord record;
+  auto drain = [&]() {
+    bool any = false;
+    while (task.poll(&record)) {
+      any = true;
+      resolved++;
+      if (pool.expected.at(record.address) != record.identity) {
+        mismatches++;
+      }
+    }
+    return any;
+  };
+  while (producing || task.processed() + task.dropped_adverts() < submitted) {
+    bool any = drain();
+    if (resolved / 20000 > updates) {
+      updates++;
+      Irk irk;
+      for (auto &b : irk.key) {
+        b = rng();
+      }
+      task.with_resolver([&](IrkResolver &r) {
+        r.begin_delta().add(irk.key);
+        r.publish();
+      });
+    }
+    if (!any) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  task.stop();
+  drain();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  bool accounted = task.processed() + task.dropped_adverts() == submitted;
+  printf("%s, %zu adverts, ring %zu: %u processed, %u dropped, %zu resolved, %u results dropped\n",
+         paced ? "paced" : "flood", adverts, ring_size, task.processed(), task.dropped_adverts(), resolved,
+         task.dropped_results());
+  printf("  %zu IRK updates, %zu mismatches, %.0f adverts/s processed\n", updates, mismatches,
+         task.processed() / elapsed);
+  if (mismatches != 0 || !accounted) {
+    printf("  FAILED%s\n", accounted ? "" : ": adverts unaccounted for");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  size_t adverts = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+  size_t ring_size = argc > 2 ? strtoul(argv[2], nullptr, 0) : 256;
+
+  std::mt19937_64 rng(0x5bd1e995);
+  Pool pool = make_pool(rng);
+  bool ok = run(pool, adverts, ring_size, false);
+  ok &= run(pool, adverts, ring_size, true);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+import argparse
+import re
+import sys
+
+parser = argparse.ArgumentParser(description='extract an irk_resolver.dump_trace dump from an ESPHome log into a binary trace file')
+parser.add_argument('log', help='ESPHome log containing the dump (- for stdin)')
+parser.add_argument('output', help='binary trace file to write')
+args = parser.parse_args()
+
+begin_re = re.compile(r'trace begin ([0-9a-f]+)')
+record_re = re.compile(r'trace ([0-9a-f]+)\s*$')
+
+log = sys.stdin if args.log == '-' else open(args.log)
+header = None
+records = []
+for line in log:
+    m = begin_re.search(line)
+    if m:
+        # only keep the most recent dump in the log
+        header = bytes.fromhex(m.group(1))
+        records = []
+        continue
+    m = record_re.search(line)
+    if m and header is not None:
+        records.append(bytes.fromhex(m.group(1)))
+
+if header is None:
+    sys.exit('no trace dump found')
+
+with open(args.output, 'wb') as f:
+    f.write(header)
+    for r in records:
+        f.write(r)
+print(f'wrote {sum(len(r) for r in records) // 16} records to {args.output}')
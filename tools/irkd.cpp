@@ -0,0 +1,557 @@
+// Resolver daemon for Linux BLE listeners (ble_listener.py --irkd). It takes
+// raw adverts, resolves them against the IRK list on every core, and forwards
+// only the matches to Home Assistant, batched into the same binary frames the
+// irk_resolver component sends (esphome.ble_tracking_frame).
+//
+//   g++ -O2 -std=gnu++17 -pthread -I custom_components/irk_resolver -o irkd tools/irkd.cpp
+//       custom_components/irk_resolver/rpa_resolver.cpp custom_components/irk_resolver/resolver_task.cpp
+//       custom_components/irk_resolver/frame.cpp custom_components/irk_resolver/aes_host.cpp
+//
+//   irkd [options] (--irks <file> | --homeassistant <host> --access-token <token>)
+//
+//   --udp <port>           read adverts from UDP datagrams on 127.0.0.1:<port> instead of stdin
+//   --threads <n>          resolver threads, one per core by default
+//   --irks <file>          IRK list in sensor.irk_prefilter's format, reread on SIGHUP
+//   --homeassistant <host> post frames to http://<host>:8123, and without --irks poll sensor.irk_prefilter there
+//   --access-token <token> long lived Home Assistant access token
+//   --source <name>        source to label the frames with (the room)
+//   --max-records <n>      records per frame, 32 by default
+//   --deadline <ms>        longest a record waits for its frame to fill, 1000 by default
+//   --synthetic <n>        resolve n generated adverts, check every match and report throughput, then exit
+//
+// Each input line or datagram is one advert: an address and an RSSI, such as
+// "5A:1B:2C:3D:4E:5F -67". Without --homeassistant, frames are printed to
+// stdout, base64, one per line, for tools/irk_frame_receiver.py --file -.
+//
+// AES runs on AES-NI on x86-64 and the ARMv8 crypto extensions on 64-bit
+// ARM when the CPU has them (see aes_host.h). Adverts are spread over the
+// threads by address, so an RPA always lands on the thread whose identity
+// table and cache already know it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "resolver_task.h"
+#include "rpa_resolver.h"
+
+using namespace esphome::irk_resolver;
+
+static const size_t RING_SIZE = 1024;
+static const uint32_t PREFILTER_POLL_MS = 60000;
+static const int HTTP_TIMEOUT_S = 5;
+static const size_t SYNTHETIC_ADDRESSES = 4096;
+
+static std::atomic<bool> stopping{false};
+static std::atomic<bool> reload{false};
+
+struct Options {
+  int udp_port{0};
+  size_t threads{0};
+  std::string irks_file;
+  std::string homeassistant;
+  std::string access_token;
+  std::string source{"irkd"};
+  size_t max_records{32};
+  uint32_t deadline_ms{1000};
+  size_t synthetic{0};
+};
+
+static uint32_t now_ms() {
+  return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::string base64_encode(const std::vector<uint8_t> &data) {
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    size_t n = std::min<size_t>(3, data.size() - i);
+    uint32_t v = data[i] << 16 | (n > 1 ? data[i + 1] << 8 : 0) | (n > 2 ? data[i + 2] : 0);
+    for (size_t j = 0; j < 4; j++) {
+      out += j <= n ? alphabet[(v >> (18 - 6 * j)) & 0x3f] : '=';
+    }
+  }
+  return out;
+}
+
+// Minimal blocking HTTP/1.1 client, enough for Home Assistant's REST API; returns the status code, or -1
+static int http_request(const Options &opts, const char *method, const std::string &path, const std::string &body,
+                        std::string *response) {
+  std::string host = opts.homeassistant, port = "8123";
+  size_t colon = host.rfind(':');
+  if (colon != std::string::npos) {
+    port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+  }
+  addrinfo hints{}, *res;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  timeval timeout{HTTP_TIMEOUT_S, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  bool connected = fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+  freeaddrinfo(res);
+  if (!connected) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  std::string request = std::string(method) + " " + path + " HTTP/1.1\r\nHost: " + host +
+                        "\r\nAuthorization: Bearer " + opts.access_token +
+                        "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+                        "\r\nConnection: close\r\n\r\n" + body;
+  for (size_t sent = 0; sent < request.size();) {
+    ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      close(fd);
+      return -1;
+    }
+    sent += n;
+  }
+  std::string reply;
+  char buf[4096];
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    reply.append(buf, n);
+  }
+  close(fd);
+
+  int status = -1;
+  if (sscanf(reply.c_str(), "HTTP/1.%*d %d", &status) != 1) {
+    return -1;
+  }
+  if (response != nullptr) {
+    size_t body_start = reply.find("\r\n\r\n");
+    *response = body_start == std::string::npos ? "" : reply.substr(body_start + 4);
+  }
+  return status;
+}
+
+// Fetches the state of sensor.irk_prefilter; the IRK list never holds a character JSON would escape
+static bool fetch_prefilter(const Options &opts, std::string *irks) {
+  std::string body;
+  if (http_request(opts, "GET", "/api/states/sensor.irk_prefilter", "", &body) != 200) {
+    return false;
+  }
+  size_t key = body.find("\"state\"");
+  size_t start = key == std::string::npos ? key : body.find('"', body.find(':', key));
+  size_t end = start == std::string::npos ? start : body.find('"', start + 1);
+  if (end == std::string::npos) {
+    return false;
+  }
+  *irks = body.substr(start + 1, end - start - 1);
+  return true;
+}
+
+static bool read_irks(const Options &opts, std::string *irks) {
+  if (opts.irks_file.empty()) {
+    return fetch_prefilter(opts, irks);
+  }
+  std::ifstream file(opts.irks_file);
+  if (!file) {
+    return false;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  *irks = contents.str();
+  return true;
+}
+
+static bool parse_advert(const char *line, uint64_t *address, int *rssi) {
+  unsigned b[6];
+  if (sscanf(line, " %2x:%2x:%2x:%2x:%2x:%2x %d", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], rssi) != 7) {
+    return false;
+  }
+  *address = 0;
+  for (unsigned byte : b) {
+    *address = *address << 8 | byte;
+  }
+  return true;
+}
+
+class Daemon {
+ public:
+  explicit Daemon(const Options &opts) : opts_(opts), batch_(opts.max_records, 0) {
+    for (size_t i = 0; i < opts.threads; i++) {
+      this->resolvers_.emplace_back(new IrkResolver());
+      this->tasks_.emplace_back(new ResolverTask(*this->resolvers_.back(), RING_SIZE));
+    }
+  }
+
+  bool start() {
+    for (size_t i = 0; i < this->tasks_.size(); i++) {
+      if (!this->tasks_[i]->start(i, 0)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void stop() {
+    for (auto &task : this->tasks_) {
+      task->stop();
+    }
+  }
+
+  // Loads irks into every resolver, unless they are what is loaded already
+  void load(const std::string &irks) {
+    if (irks == this->loaded_) {
+      return;
+    }
+    IrkListParseResult result{};
+    for (size_t i = 0; i < this->tasks_.size(); i++) {
+      this->tasks_[i]->with_resolver([&](IrkResolver &resolver) {
+        // matches against the old IRKs are keyed before their slots change, and sent with the next poll()
+        this->collect_(i, [](const ResolvedRecord &) {});
+        result = parse_irk_list(irks, resolver.begin_update());
+        resolver.publish();
+        resolver.set_generation(result.generation);
+      });
+    }
+    this->loaded_ = irks;
+    this->generation_ = result.generation;
+    fprintf(stderr, "loaded %zu IRKs, generation %u, %zu rejected\n", result.loaded, result.generation,
+            result.rejected);
+  }
+
+  // Queues an advert on the thread that owns its address; with wait, blocks instead of dropping it when that
+  // thread is behind. Call from one thread only.
+  void submit(uint64_t address, int rssi, bool wait) {
+    if (!is_rpa(address)) {
+      this->non_rpa_++;
+      return;
+    }
+    auto &task = this->tasks_[(address * 0x9E3779B97F4A7C15ULL >> 32) % this->tasks_.size()];
+    while (wait && task->queued() >= RING_SIZE - 1 && !stopping) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    task->submit(address, std::max(-128, std::min(127, rssi)), now_ms());
+    this->submitted_++;
+  }
+
+  // Forwards resolved adverts; check, when set, is given every match
+  template<typename F> void poll(F &&check) {
+    for (size_t i = 0; i < this->tasks_.size(); i++) {
+      this->collect_(i, check);
+    }
+    // threads finish out of order; frames want records in time order
+    std::sort(this->pending_.begin(), this->pending_.end(), [](const PendingRecord &a, const PendingRecord &b) {
+      return (int32_t) (a.record.timestamp_ms - b.record.timestamp_ms) < 0;
+    });
+    for (auto &pending : this->pending_) {
+      const ResolvedRecord &record = pending.record;
+      this->resolved_++;
+      // a record that arrives after a later one from another thread is sent with the later time
+      uint32_t ts = this->batch_.empty() || (int32_t) (record.timestamp_ms - this->last_ms_) >= 0 ? record.timestamp_ms
+                                                                                                 : this->last_ms_;
+      if (!this->batch_.add(ts, pending.key, record.rssi)) {
+        this->send_();
+        this->batch_.add(ts, pending.key, record.rssi);
+      }
+      this->last_ms_ = ts;
+      if (this->batch_.full()) {
+        this->send_();
+      }
+    }
+    this->pending_.clear();
+    if (!this->batch_.empty() && now_ms() - this->batch_.first_ms() >= this->opts_.deadline_ms) {
+      this->send_();
+    }
+  }
+
+  void flush() {
+    if (!this->batch_.empty()) {
+      this->send_();
+    }
+  }
+
+  // Whether every submitted advert has been resolved or dropped
+  bool idle() const {
+    uint64_t done = 0;
+    for (auto &task : this->tasks_) {
+      done += task->processed() + task->dropped_adverts();
+    }
+    return done == this->submitted_;
+  }
+
+  void print_stats(double elapsed) const {
+    uint32_t dropped = 0, hits = 0, misses = 0;
+    for (auto &task : this->tasks_) {
+      dropped += task->dropped_adverts() + task->dropped_results();
+    }
+    for (auto &resolver : this->resolvers_) {
+      hits += resolver->cache_hits();
+      misses += resolver->cache_misses();
+    }
+    fprintf(stderr, "%llu RPAs, %llu non-RPA, %llu resolved, %u dropped, %llu frames sent, %llu failed\n",
+            (unsigned long long) this->submitted_, (unsigned long long) this->non_rpa_,
+            (unsigned long long) this->resolved_, dropped, (unsigned long long) this->frames_,
+            (unsigned long long) this->failed_);
+    fprintf(stderr, "cache hits %u, misses %u, %zu threads, %s AES, %.0f RPAs/s\n", hits, misses,
+            this->tasks_.size(), host_aes_backend_name(host_aes_backend()), elapsed > 0 ? this->submitted_ / elapsed : 0.0);
+  }
+
+ protected:
+  struct PendingRecord {
+    ResolvedRecord record;
+    uint32_t key;
+  };
+
+  // Takes thread i's matches, keyed by frame_identity_key() while its resolver still holds the IRKs they resolved to
+  template<typename F> void collect_(size_t i, F &&check) {
+    ResolvedRecord record;
+    while (this->tasks_[i]->poll(&record)) {
+      check(record);
+      // only this thread loads IRKs, so reading the published table here is safe
+      const uint8_t *irk = this->resolvers_[i]->irk(record.identity);
+      if (irk != nullptr) {
+        this->pending_.push_back(PendingRecord{record, frame_identity_key(irk)});
+      }
+    }
+  }
+
+  void send_() {
+    std::string frame = base64_encode(this->batch_.finish(this->generation_));
+    this->batch_.clear();
+    this->frames_++;
+    if (this->opts_.homeassistant.empty()) {
+      if (this->opts_.synthetic == 0) {
+        printf("%s\n", frame.c_str());
+        fflush(stdout);
+      }
+      return;
+    }
+    std::string body = "{\"source\": \"" + this->opts_.source + "\", \"frame\": \"" + frame + "\"}";
+    int status = http_request(this->opts_, "POST", "/api/events/esphome.ble_tracking_frame", body, nullptr);
+    if (status != 200) {
+      this->failed_++;
+      fprintf(stderr, "posting a frame failed: %d\n", status);
+    }
+  }
+
+  const Options &opts_;
+  std::vector<std::unique_ptr<IrkResolver>> resolvers_;
+  std::vector<std::unique_ptr<ResolverTask>> tasks_;
+  std::string loaded_;
+  uint32_t generation_{0};
+  FrameEncoder batch_;
+  uint32_t last_ms_{0};
+  std::vector<PendingRecord> pending_;
+  uint64_t submitted_{0};
+  uint64_t non_rpa_{0};
+  uint64_t resolved_{0};
+  uint64_t frames_{0};
+  uint64_t failed_{0};
+};
+
+// Reads adverts from stdin or a UDP socket until EOF or a signal; sets done when finished
+static void read_input(const Options &opts, Daemon &daemon, std::atomic<bool> &done) {
+  char line[256];
+  if (opts.udp_port == 0) {
+    while (!stopping && fgets(line, sizeof(line), stdin) != nullptr) {
+      uint64_t address;
+      int rssi;
+      if (parse_advert(line, &address, &rssi)) {
+        // a file or pipe can wait for the resolvers, so nothing is dropped
+        daemon.submit(address, rssi, true);
+      }
+    }
+    done = true;
+    return;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(opts.udp_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+    perror("udp");
+    stopping = true;
+    done = true;
+    return;
+  }
+  // wakes up now and then to notice a signal
+  timeval timeout{0, 200000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  while (!stopping) {
+    ssize_t n = recv(fd, line, sizeof(line) - 1, 0);
+    if (n <= 0) {
+      continue;
+    }
+    line[n] = 0;
+    uint64_t address;
+    int rssi;
+    if (parse_advert(line, &address, &rssi)) {
+      // live adverts keep coming, so a thread that falls behind drops rather than holds up the rest
+      daemon.submit(address, rssi, false);
+    }
+  }
+  close(fd);
+  done = true;
+}
+
+// Generates count adverts, a quarter of them from IRKs in irks, recording which identity each must resolve to
+static void synthesize(const std::string &irks, size_t count, Daemon &daemon,
+                       std::unordered_map<uint64_t, int> &expected, std::atomic<bool> &done) {
+  IrkTable table;
+  parse_irk_list(irks, table);
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> addresses;
+  for (size_t i = 0; i < SYNTHETIC_ADDRESSES; i++) {
+    uint8_t rpa[6];
+    for (auto &b : rpa) {
+      b = rng();
+    }
+    rpa[5] = (rpa[5] & 0x3f) | 0x40;
+    int identity = i % 4 == 0 && table.size() > 0 ? rng() % table.size() : -1;
+    if (identity >= 0) {
+      uint8_t plain_text[16], cipher_text[16];
+      ble_ll_rpa_plain_text(rpa, plain_text);
+      bt_encrypt_be(table.irks()[identity].key, plain_text, cipher_text);
+      rpa[0] = cipher_text[15];
+      rpa[1] = cipher_text[14];
+      rpa[2] = cipher_text[13];
+    }
+    addresses.push_back(rpa_to_uint64(rpa));
+    expected[addresses.back()] = identity;
+  }
+  for (size_t i = 0; i < count && !stopping; i++) {
+    daemon.submit(addresses[rng() % addresses.size()], -60, true);
+  }
+  done = true;
+}
+
+static bool parse_options(int argc, char **argv, Options *opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char *value = argv[++i];
+    if (arg == "--udp") {
+      opts->udp_port = atoi(value);
+    } else if (arg == "--threads") {
+      opts->threads = atoi(value);
+    } else if (arg == "--irks") {
+      opts->irks_file = value;
+    } else if (arg == "--homeassistant") {
+      opts->homeassistant = value;
+    } else if (arg == "--access-token") {
+      opts->access_token = value;
+    } else if (arg == "--source") {
+      opts->source = value;
+    } else if (arg == "--max-records") {
+      opts->max_records = std::max(1, std::min((int) FRAME_MAX_RECORDS, atoi(value)));
+    } else if (arg == "--deadline") {
+      opts->deadline_ms = atoi(value);
+    } else if (arg == "--synthetic") {
+      opts->synthetic = strtoul(value, nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  if (opts->threads == 0) {
+    opts->threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return !opts->irks_file.empty() || !opts->homeassistant.empty();
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parse_options(argc, argv, &opts)) {
+    fprintf(stderr,
+            "usage: %s [--udp <port>] [--threads <n>] [--source <name>] [--max-records <n>] [--deadline <ms>]\n"
+            "          [--synthetic <n>] (--irks <file> | --homeassistant <host> --access-token <token>)\n",
+            argv[0]);
+    return 2;
+  }
+  signal(SIGINT, [](int) { stopping = true; });
+  signal(SIGTERM, [](int) { stopping = true; });
+  signal(SIGHUP, [](int) { reload = true; });
+
+  Daemon daemon(opts);
+  std::string irks;
+  if (!read_irks(opts, &irks)) {
+    fprintf(stderr, "cannot read the IRK list from %s\n",
+            opts.irks_file.empty() ? opts.homeassistant.c_str() : opts.irks_file.c_str());
+    return 1;
+  }
+  daemon.load(irks);
+  if (!daemon.start()) {
+    fprintf(stderr, "cannot start the resolver threads\n");
+    return 1;
+  }
+
+  std::unordered_map<uint64_t, int> expected;
+  size_t mismatches = 0;
+  std::atomic<bool> input_done{false};
+  std::thread input;
+  if (opts.synthetic > 0) {
+    // generated up front, so the map isn't touched while matches are checked
+    input = std::thread(synthesize, irks, opts.synthetic, std::ref(daemon), std::ref(expected), std::ref(input_done));
+  } else {
+    input = std::thread(read_input, std::cref(opts), std::ref(daemon), std::ref(input_done));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t polled_prefilter = now_ms();
+  // expected is complete before the first advert is submitted, and the rings order it before every match
+  auto check = [&](const ResolvedRecord &record) {
+    if (opts.synthetic > 0) {
+      auto it = expected.find(record.address);
+      if (it == expected.end() || it->second != record.identity) {
+        mismatches++;
+      }
+    }
+  };
+  while (!stopping && !(input_done && daemon.idle())) {
+    daemon.poll(check);
+    if (reload.exchange(false) || (opts.irks_file.empty() && now_ms() - polled_prefilter >= PREFILTER_POLL_MS)) {
+      polled_prefilter = now_ms();
+      if (read_irks(opts, &irks)) {
+        daemon.load(irks);
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  daemon.poll(check);
+  daemon.flush();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  stopping = true;
+  input.join();
+  daemon.stop();
+  daemon.print_stats(elapsed);
+  if (opts.synthetic > 0) {
+    fprintf(stderr, "%zu mismatches\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+  }
+  return 0;
+}